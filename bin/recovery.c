@@ -405,7 +405,7 @@ ClearLoadedPage(RelFileNode rnode, BlockNumber blkbeg, BlockNumber blkend)
 	ssize_t		readlen;			/* size of data read by read()	*/
 
 	/* if no block is created by pg_bulkload, no work needed. */
-	if (blkbeg <= blkend)
+	if (blkbeg >= blkend)
 		return;
 
 	/*
@@ -468,6 +468,14 @@ ClearLoadedPage(RelFileNode rnode, BlockNumber blkbeg, BlockNumber blkend)
 						 "could not read data file \"%s\": %s",
 						 segpath, strerror(errno));
 			}
+			else if (ret == 0 && readlen == 0)
+			{
+				/*
+				 * end of the data, the rest of the range was reserved in the
+				 * load status file but not written.
+				 */
+				break;
+			}
 			else if (ret == 0)
 			{
 				/*
@@ -480,6 +488,8 @@ ClearLoadedPage(RelFileNode rnode, BlockNumber blkbeg, BlockNumber blkend)
 		}
 		while (readlen < BLCKSZ);
 
+		if (readlen == 0)
+			break;
 
 		/*
 		 * if page is created by pg_bulkload, overwrite it by blank page.
@@ -520,9 +530,14 @@ ClearLoadedPage(RelFileNode rnode, BlockNumber blkbeg, BlockNumber blkend)
 
 			fd = open(segpath, O_RDWR | PG_BINARY, S_IRUSR | S_IWUSR);
 			if (fd == -1)
+			{
+				/* reserved blocks might not have reached the next segment */
+				if (errno == ENOENT)
+					return;
 				elog(ERROR,
 					 "could not open data file \"%s\": %s",
 					 segpath, strerror(errno));
+			}
 		}
 	}
 
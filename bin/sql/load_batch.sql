@@ -0,0 +1,35 @@
+-- every row of a batch must be loaded even if the parser reuses its tuple
+CREATE TABLE batch (
+    id  int NOT NULL,
+    val text NOT NULL
+);
+CREATE FUNCTION batch_f(int4, text) RETURNS batch AS
+$$
+    SELECT $1, $2 || '!';
+$$ LANGUAGE SQL;
+CREATE FUNCTION batch_rows(int4) RETURNS SETOF batch AS
+$$
+    SELECT i, 'row' || i FROM generate_series(1, $1) i;
+$$ LANGUAGE SQL;
+\! awk 'BEGIN { for (i = 1; i <= 2500; i++) print i ",row" i }' > results/batch.csv
+
+-- FILTER
+TRUNCATE batch;
+\! pg_bulkload -d contrib_regression data/csv11.ctl -i results/batch.csv -l results/batch1.log -P results/batch1.prs -u results/batch1.dup -o "FILTER=batch_f"
+SELECT count(*) AS rows, count(DISTINCT id) AS ids, count(DISTINCT val) AS vals, sum(id) FROM batch;
+
+-- FILTER with a writer process and heap_multi_insert
+TRUNCATE batch;
+\! pg_bulkload -d contrib_regression data/csv11.ctl -i results/batch.csv -l results/batch2.log -P results/batch2.prs -u results/batch2.dup -o "FILTER=batch_f" -o "WRITER=BUFFERED" -o "MULTI_PROCESS=YES"
+SELECT count(*) AS rows, count(DISTINCT id) AS ids, count(DISTINCT val) AS vals, sum(id) FROM batch;
+
+-- TYPE = FUNCTION
+TRUNCATE batch;
+\! pg_bulkload -d contrib_regression data/function2.ctl -o "INFILE=batch_rows(2500)" -l results/batch3.log
+SELECT count(*) AS rows, count(DISTINCT id) AS ids, count(DISTINCT val) AS vals, sum(id) FROM batch;
+
+-- TYPE = TUPLE in the writer process
+TRUNCATE batch;
+\! pg_bulkload -d contrib_regression data/csv11.ctl -i results/batch.csv -l results/batch4.log -P results/batch4.prs -u results/batch4.dup -o "MULTI_PROCESS=YES"
+SELECT count(*) AS rows, count(DISTINCT id) AS ids, count(DISTINCT val) AS vals, sum(id) FROM batch;
+
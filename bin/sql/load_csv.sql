@@ -84,3 +84,21 @@ SET enable_bitmapscan = off;
 SELECT * FROM customer ORDER BY c_id;
 
 \! diff data/data3.csv results/csv7.prs
+
+-- an escape character at EOF leaves the quoted field unterminated
+CREATE TABLE eof_quote (id int, val text);
+\! printf '1,"a"\n2,"b!' > results/eof_quote.csv
+\! pg_bulkload -d contrib_regression data/csv13.ctl -i results/eof_quote.csv -l results/csv8.log -P results/csv8.prs -u results/csv8.dup -o "READ_METHOD=MMAP"
+\! pg_bulkload -d contrib_regression data/csv13.ctl -i results/eof_quote.csv -l results/csv9.log -P results/csv9.prs -u results/csv9.dup -o "READ_METHOD=BUFFERED"
+SELECT * FROM eof_quote ORDER BY id;
+\! diff results/csv8.prs results/csv9.prs
+
+-- PARSE_THREADS reports the same records as a serial load
+CREATE TABLE parse_serial (id int, val text);
+CREATE TABLE parse_threads (id int, val text);
+\! awk 'BEGIN { for (i = 1; i <= 300000; i++) { if (i % 20000 == 0) print "x" i ",bad"; else if (i % 20000 == 10000) print "x" i ",\"bad\n" i ",row\""; else if (i % 7 == 0) print i ",\"row " i "\n" i ",\"\"quoted\"\"\""; else print i ",row " i " abcdefghijklmnopqrstuvwxyz" } }' > results/parse_threads.csv
+\! pg_bulkload -d contrib_regression data/csv14.ctl -i results/parse_threads.csv -O parse_serial -l results/csv10.log -P results/csv10.prs -u results/csv10.dup
+\! pg_bulkload -d contrib_regression data/csv14.ctl -i results/parse_threads.csv -O parse_threads -l results/csv11.log -P results/csv11.prs -u results/csv11.dup -o "READ_METHOD=MMAP" -o "PARSE_THREADS=4"
+SELECT count(*), sum(id), count(DISTINCT val) FROM parse_threads;
+SELECT count(*) FROM parse_serial s FULL JOIN parse_threads t USING (id, val) WHERE s.id IS NULL OR t.id IS NULL;
+\! diff results/csv10.prs results/csv11.prs
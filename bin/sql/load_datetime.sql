@@ -0,0 +1,16 @@
+-- DATETIME_FORMAT: date/time columns parsed by compiled formats
+CREATE TABLE datetime_format (
+    id  int NOT NULL,
+    d   date,
+    ts  timestamp,
+    ts2 timestamp(2),
+    ed  date,
+    ets timestamp,
+    etz timestamptz
+);
+
+\! pg_bulkload -d contrib_regression data/csv10.ctl -i data/data10.csv -l results/datetime1.log -P results/datetime1.prs -u results/datetime1.dup -o "PARSE_ERRORS=10"
+
+SET DateStyle = ISO;
+SELECT id, d, ts, ts2 FROM datetime_format ORDER BY id;
+SELECT id, ed, ets, extract(epoch FROM etz) AS etz FROM datetime_format ORDER BY id;
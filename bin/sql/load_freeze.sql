@@ -0,0 +1,27 @@
+-- FREEZE: load frozen and all-visible pages into a truncated table
+CREATE TABLE frozen (
+    id  int NOT NULL,
+    val text NOT NULL
+);
+CREATE INDEX frozen_id ON frozen (id);
+INSERT INTO frozen VALUES (0, 'old');
+
+\! pg_bulkload -d contrib_regression data/csv9.ctl -i data/data9.csv -l results/freeze1.log -P results/freeze1.prs -u results/freeze1.dup -o "TRUNCATE=YES" -o "FREEZE=YES"
+
+SET enable_seqscan = on;
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+SELECT * FROM frozen ORDER BY id;
+
+SET enable_seqscan = off;
+SET enable_indexscan = on;
+SET enable_bitmapscan = off;
+SELECT * FROM frozen ORDER BY id;
+
+-- FREEZE requires a relfilenode created in the current transaction
+\! pg_bulkload -d contrib_regression data/csv9.ctl -i data/data9.csv -l results/freeze2.log -P results/freeze2.prs -u results/freeze2.dup -o "FREEZE=YES"
+
+SET enable_seqscan = on;
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+SELECT * FROM frozen ORDER BY id;
@@ -0,0 +1,42 @@
+-- INDEX_UPDATE: load a small delta into a table with existing indexes
+CREATE TABLE delta (
+    id  int NOT NULL,
+    val text NOT NULL
+);
+CREATE UNIQUE INDEX delta_id ON delta (id);
+CREATE INDEX delta_val ON delta (val);
+INSERT INTO delta SELECT i * 2, 'old' FROM generate_series(1, 10000) i;
+ANALYZE delta;
+
+\! pg_bulkload -d contrib_regression data/csv8.ctl -i data/data8.csv -l results/index1.log -P results/index1.prs -u results/index1.dup -o "LOAD=2" -o "INDEX_UPDATE=REBUILD"
+
+SET enable_seqscan = off;
+SET enable_indexscan = on;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM delta WHERE id > 0;
+SELECT * FROM delta WHERE val = 'new' ORDER BY id;
+
+\! pg_bulkload -d contrib_regression data/csv8.ctl -i data/data8.csv -l results/index2.log -P results/index2.prs -u results/index2.dup -o "SKIP=2" -o "LOAD=2" -o "INDEX_UPDATE=INSERT"
+
+SET enable_seqscan = off;
+SET enable_indexscan = on;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM delta WHERE id > 0;
+SELECT * FROM delta WHERE val = 'new' ORDER BY id;
+
+\! pg_bulkload -d contrib_regression data/csv8.ctl -i data/data8.csv -l results/index3.log -P results/index3.prs -u results/index3.dup -o "SKIP=4" -o "LOAD=2" -o "INDEX_UPDATE=AUTO"
+
+SET enable_seqscan = off;
+SET enable_indexscan = on;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM delta WHERE id > 0;
+SELECT * FROM delta WHERE val = 'new' ORDER BY id;
+
+-- a key that already exists is an error if no duplicates are allowed
+\! pg_bulkload -d contrib_regression data/csv8.ctl -i data/data8.csv -l results/index4.log -P results/index4.prs -u results/index4.dup -o "SKIP=6" -o "INDEX_UPDATE=INSERT" -o "DUPLICATE_ERRORS=0"
+
+SET enable_seqscan = off;
+SET enable_indexscan = on;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM delta WHERE id > 0;
+SELECT * FROM delta WHERE val = 'new' ORDER BY id;
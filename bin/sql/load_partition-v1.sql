@@ -0,0 +1,16 @@
+-- inheritance children are chosen by their CHECK constraints in OID order
+CREATE TABLE inh (
+    id  int NOT NULL,
+    val text
+);
+CREATE TABLE inh_low (CHECK (id < 100)) INHERITS (inh);
+CREATE TABLE inh_mid (CHECK (id >= 50 AND id < 200)) INHERITS (inh);
+
+-- 60 goes to inh_low even after a row for inh_mid, and 250 stays in inh
+\! pg_bulkload -d contrib_regression data/csv12.ctl -i data/data11.csv -O inh -l results/part1.log -P results/part1.prs -u results/part1.dup
+SELECT tableoid::regclass, * FROM inh ORDER BY id;
+
+-- a child without CHECK constraints would accept every row
+CREATE TABLE inh_any () INHERITS (inh);
+\! pg_bulkload -d contrib_regression data/csv12.ctl -i data/data11.csv -O inh -l results/part2.log -P results/part2.prs -u results/part2.dup
+SELECT count(*) FROM inh;
@@ -0,0 +1,30 @@
+-- inheritance children are chosen by their CHECK constraints in OID order
+CREATE TABLE inh (
+    id  int NOT NULL,
+    val text
+);
+CREATE TABLE inh_low (CHECK (id < 100)) INHERITS (inh);
+CREATE TABLE inh_mid (CHECK (id >= 50 AND id < 200)) INHERITS (inh);
+
+-- 60 goes to inh_low even after a row for inh_mid, and 250 stays in inh
+\! pg_bulkload -d contrib_regression data/csv12.ctl -i data/data11.csv -O inh -l results/part1.log -P results/part1.prs -u results/part1.dup
+SELECT tableoid::regclass, * FROM inh ORDER BY id;
+
+-- a child without CHECK constraints would accept every row
+CREATE TABLE inh_any () INHERITS (inh);
+\! pg_bulkload -d contrib_regression data/csv12.ctl -i data/data11.csv -O inh -l results/part2.log -P results/part2.prs -u results/part2.dup
+SELECT count(*) FROM inh;
+
+-- partitions are chosen by their bounds
+CREATE TABLE part (
+    id  int NOT NULL,
+    val text
+) PARTITION BY RANGE (id);
+CREATE TABLE part_low PARTITION OF part FOR VALUES FROM (0) TO (100);
+CREATE TABLE part_high PARTITION OF part FOR VALUES FROM (100) TO (200);
+\! pg_bulkload -d contrib_regression data/csv12.ctl -i data/data11.csv -O part -l results/part3.log -P results/part3.prs -u results/part3.dup -o "LOAD=4"
+SELECT tableoid::regclass, * FROM part ORDER BY id;
+
+-- a row that fits no partition is an error
+TRUNCATE part;
+\! pg_bulkload -d contrib_regression data/csv12.ctl -i data/data11.csv -O part -l results/part4.log -P results/part4.prs -u results/part4.dup
@@ -29,6 +29,10 @@ typedef struct Spooler
 	int64			dup_new;	/**< number of not loaded by duplicate error */
 	char		   *dup_badfile;
 	FILE		   *dup_fp;
+	bool			dup_append;	/**< append to dup_badfile? */
+	bool			empty;		/**< indexes are known to be empty? */
+	INDEX_UPDATE	index_update;	/**< rebuild or insert into indexes */
+	int64			spooled;	/**< number of spooled heap tuples */
 } Spooler;
 
 /* External declarations */
@@ -37,7 +41,8 @@ extern void SpoolerOpen(Spooler *self,
 						bool use_wal,
 						ON_DUPLICATE on_duplicate,
 						int64 max_dup_errors,
-						const char *dup_badfile);
+						const char *dup_badfile,
+						INDEX_UPDATE index_update);
 extern void SpoolerClose(Spooler *self);
 extern void SpoolerInsert(Spooler *self, HeapTuple tuple);
 
@@ -58,6 +58,15 @@ typedef enum ON_DUPLICATE
 
 extern const char *ON_DUPLICATE_NAMES[2];
 
+typedef enum INDEX_UPDATE
+{
+	INDEX_UPDATE_AUTO,
+	INDEX_UPDATE_REBUILD,
+	INDEX_UPDATE_INSERT
+} INDEX_UPDATE;
+
+extern const char *INDEX_UPDATE_NAMES[3];
+
 typedef Parser *(*ParserCreate)(void);
 
 #define PG_BULKLOAD_COLS	8
@@ -0,0 +1,48 @@
+/*
+ * pg_bulkload: include/pg_compress.h
+ *
+ *	  Copyright (c) 2007-2016, NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *	  Portions Copyright (c) 1996-2015, PostgreSQL Global Development Group
+ *	  Portions Copyright (c) 1994, Regents of the University of California
+ */
+
+/**
+ * @file
+ * @brief Thread-safe compression of toasted values
+ *
+ * PGLZHistEntry is copied from pg_lzcompress.c in PostgreSQL 9.5.
+ */
+#ifndef PG_COMPRESS_H
+#define PG_COMPRESS_H
+
+#define PGLZ_MAX_HISTORY_LISTS	8192	/* must be power of 2 */
+#define PGLZ_HISTORY_SIZE		4096
+
+typedef struct PGLZHistEntry
+{
+	struct PGLZHistEntry *next;	/* links for my hash key's list */
+	struct PGLZHistEntry *prev;
+	int			hindex;			/* my current hash key */
+	const char *pos;			/* my input position */
+} PGLZHistEntry;
+
+/**
+ * @brief History table of the compressor.  pglz_compress() keeps it in
+ * static variables, so each thread needs its own workspace instead.
+ */
+typedef struct PGLZWorkspace
+{
+	int16			hist_start[PGLZ_MAX_HISTORY_LISTS];
+	PGLZHistEntry	hist_entries[PGLZ_HISTORY_SIZE + 1];
+} PGLZWorkspace;
+
+/* size of the header of a compressed datum; varlena header and rawsize */
+#define COMPRESS_HDRSZ			(VARHDRSZ + sizeof(int32))
+
+/* buffer size needed to compress slen bytes */
+#define COMPRESS_BUFSIZE(slen)	(COMPRESS_HDRSZ + (slen) + 4)
+
+extern bool CompressValue(const char *source, int32 slen,
+						  struct varlena *dest, PGLZWorkspace *ws);
+
+#endif   /* PG_COMPRESS_H */
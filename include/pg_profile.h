@@ -14,6 +14,7 @@
 
 /* Profiling routine */
 #ifdef ENABLE_BULKLOAD_PROFILE
+#include "nodes/pg_list.h"
 #include "portability/instr_time.h"
 
 extern instr_time *prof_top;
@@ -34,6 +35,8 @@ extern instr_time prof_merge_unique;
 extern instr_time prof_merge_insert;
 extern instr_time prof_merge_term;
 
+extern List *prof_spools;
+
 /**
  * @brief Record profile information
  */
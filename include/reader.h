@@ -13,6 +13,8 @@
 
 #include "pg_bulkload.h"
 
+#include "pgut/pgut-pthread.h"
+
 #include "access/xact.h"
 #include "lib/stringinfo.h"
 #include "nodes/execnodes.h"
@@ -33,17 +35,40 @@
 
 typedef size_t (*SourceReadProc)(Source *self, void *buffer, size_t len);
 typedef void (*SourceCloseProc)(Source *self);
+typedef char *(*SourceMapProc)(Source *self, size_t *len);
+typedef void (*SourceReleaseProc)(Source *self, size_t offset);
 
+/*
+ * map and release are optional.  If map is set, it returns the whole input
+ * followed by a '\0' sentinel, and the caller reports its progress with
+ * release so that the source can drop the data behind it.
+ */
 struct Source
 {
 	SourceReadProc		read;	/** read */
 	SourceCloseProc		close;	/** close */
+	SourceMapProc		map;	/** map whole input into memory */
+	SourceReleaseProc	release;	/** data before offset is not needed */
 };
 
-extern Source *CreateSource(const char *path, TupleDesc desc, bool async_read);
+typedef enum READ_METHOD
+{
+	READ_METHOD_BUFFERED,	/* read through the OS page cache */
+	READ_METHOD_DIRECT,		/* O_DIRECT reads by parallel read threads */
+	READ_METHOD_MMAP		/* scan a memory-mapped file in place */
+} READ_METHOD;
+
+extern const char *READ_METHOD_NAMES[3];
+
+extern Source *CreateSource(const char *path, TupleDesc desc, bool async_read,
+							READ_METHOD method);
+extern void WaitForThread(pthread_cond_t *cond, pthread_mutex_t *lock);
 
 #define SourceRead(self, buffer, len)	((self)->read((self), (buffer), (len)))
 #define SourceClose(self)				((self)->close((self)))
+#define SourceMap(self, len) \
+	((self)->map ? (self)->map((self), (len)) : NULL)
+#define SourceRelease(self, offset)		((self)->release((self), (offset)))
 
 typedef struct Checker	Checker;
 
@@ -53,6 +78,7 @@ typedef struct Checker	Checker;
 
 typedef void (*ParserInitProc)(Parser *self, Checker *checker, const char *infile, TupleDesc desc, bool multi_process, Oid collation);
 typedef HeapTuple (*ParserReadProc)(Parser *self, Checker *checker);
+typedef bool (*ParserReadBatchProc)(Parser *self, Checker *checker, HeapTuple *tuples, int *ntuples, int maxtuples);
 typedef int64 (*ParserTermProc)(Parser *self);
 typedef bool (*ParserParamProc)(Parser *self, const char *keyword, char *value);
 typedef void (*ParserDumpParamsProc)(Parser *self);
@@ -62,6 +88,7 @@ struct Parser
 {
 	ParserInitProc			init;		/**< initialize */
 	ParserReadProc			read;		/**< read one tuple */
+	ParserReadBatchProc		readBatch;	/**< read tuples, or NULL */
 	ParserTermProc			term;		/**< clean up */
 	ParserParamProc			param;		/**< parse a parameter */
 	ParserDumpParamsProc	dumpParams;	/**< dump parameters */
@@ -69,8 +96,20 @@ struct Parser
 
 	int			parsing_field;	/**< field number being parsed */
 	int64		count;			/**< number of records read from stream */
+	bool		reuse_tuple;	/**< read overwrites the last tuple? */
 };
 
+/*
+ * readBatch is optional.  It appends checked tuples to tuples[*ntuples] until
+ * *ntuples reaches maxtuples, and returns false at the end of input.  It must
+ * increment *ntuples for each tuple, and set parsing_field to -1 and check
+ * the tuple with CheckerRecord before reading the next record, because a
+ * parse error is reported for the current record and reading is resumed by
+ * calling readBatch again.  Without readBatch, read is called for each tuple,
+ * and the tuples are copied if reuse_tuple is set because the next read
+ * overwrites them.
+ */
+
 extern Parser *CreateBinaryParser(void);
 extern Parser *CreateCSVParser(void);
 extern Parser *CreateTupleParser(void);
@@ -141,12 +180,16 @@ struct Checker
 	TupleTableSlot *slot;
 	TupleDesc		desc;
 	TupleChecker   *tchecker;
+
+	/* Form tuples in the pages of the writer */
+	Writer		   *placer;		/**< writer with reserve, or NULL */
 };
 
 extern void CheckerInit(Checker *checker, Relation rel, TupleChecker *tchecker);
 extern void CheckerTerm(Checker *checker);
 extern char *CheckerConversion(Checker *checker, char *src);
 extern HeapTuple CheckerConstraints(Checker *checker, HeapTuple tuple, int *parsing_field);
+extern HeapTuple CheckerRecord(Checker *checker, HeapTuple tuple, int *parsing_field);
 
 /**
  * @brief Reader
@@ -177,18 +220,32 @@ struct Reader
 	 */
 	int64			parse_errors;	/**< number of parse errors ignored */
 	FILE		   *parse_fp;
+	int				ntuples;		/**< tuples read in the current batch */
+	bool			eof;			/**< no more tuples to read */
 };
 
+/* number of tuples passed from the reader to the writer at once */
+#define READER_BATCH_SIZE	1000
+
 extern Reader *ReaderCreate(char *type);
 extern void ReaderInit(Reader *self);
 extern bool ReaderParam(Reader *rd, const char *keyword, char *value);
 extern HeapTuple ReaderNext(Reader *rd);
+extern int ReaderNextBatch(Reader *rd, HeapTuple *tuples, int maxtuples);
 extern void ReaderDumpParams(Reader *rd);
 extern int64 ReaderClose(Reader *rd, bool onError);
 
 /* TupleFormer */
 
-typedef struct TupleFormer
+typedef struct TupleFormer	TupleFormer;
+typedef struct DateTimeFormat	DateTimeFormat;
+typedef struct ValueCache	ValueCache;
+
+/* convert a field string into a datum of column col */
+typedef Datum (*TupleFormerInputProc)(TupleFormer *former, const char *str,
+									  int col);
+
+struct TupleFormer
 {
 	TupleDesc	desc;		/**< descriptor */
 	Datum	   *values;		/**< array[desc->natts] of values */
@@ -196,16 +253,23 @@ typedef struct TupleFormer
 	Oid		   *typId;		/**< array[desc->natts] of type oid */
 	Oid		   *typIOParam;	/**< array[desc->natts] of type information */
 	FmgrInfo   *typInput;	/**< array[desc->natts] of type input functions */
+	TupleFormerInputProc *typFastInput;	/**< array[desc->natts] of converters */
+	DateTimeFormat **typFormat;	/**< array[desc->natts] of DATETIME_FORMAT */
+	ValueCache **typCache;	/**< array[desc->natts] of value caches */
+	MemoryContext cacheContext;	/**< context for the value caches */
 	Oid		   *typMod;		/**< array[desc->natts] of type modifiers */
 	int		   *attnum;		/**< array[maxfields] of attnum mapping */
 	int			minfields;	/**< min number of valid fields */
 	int			maxfields;	/**< max number of valid fields */
-} TupleFormer;
+};
 
 typedef struct Filter	Filter;
 extern void TupleFormerInit(TupleFormer *former, Filter *filter, TupleDesc desc);
+extern void TupleFormerSetFormat(TupleFormer *former, const char *spec);
+extern void TupleFormerSetCache(TupleFormer *former, const char *name);
 extern void TupleFormerTerm(TupleFormer *former);
 extern HeapTuple TupleFormerTuple(TupleFormer *former);
+extern HeapTuple TupleFormerPlace(TupleFormer *former, Writer *placer);
 extern Datum TupleFormerValue(TupleFormer *former, const char *str, int col);
 
 #if PG_VERSION_NUM >= 90204
@@ -38,19 +38,27 @@ typedef struct WriterResult
 
 typedef void (*WriterInitProc)(Writer *self);
 typedef bool (*WriterInsertProc)(Writer *self, HeapTuple tuple);
+typedef void (*WriterInsertBatchProc)(Writer *self, HeapTuple *tuples, int ntuples);
 typedef WriterResult (*WriterCloseProc)(Writer *self, bool onError);
 typedef bool (*WriterParamProc)(Writer *self, const char *keyword, char *value);
 typedef void (*WriterDumpParamsProc)(Writer *self);
 typedef int (*WriterSendQueryProc)(Writer *self, PGconn *conn, char *queueName, char *logfile, bool verbose);
+typedef HeapTuple (*WriterReserveProc)(Writer *self, Size len);
+typedef void (*WriterConfirmProc)(Writer *self, HeapTuple tuple);
+typedef void (*WriterCancelProc)(Writer *self);
 
 struct Writer
 {
 	WriterInitProc			init;		/**< initialize */
 	WriterInsertProc		insert;		/**< insert one tuple */
+	WriterInsertBatchProc	insertBatch;	/**< insert tuples, or NULL */
 	WriterCloseProc			close;		/**< clean up */
 	WriterParamProc			param;		/**< parse a parameter */
 	WriterDumpParamsProc	dumpParams;	/**< dump parameters */
 	WriterSendQueryProc		sendQuery;	/**< send query to parallel writer */
+	WriterReserveProc		reserve;	/**< reserve space for a tuple, or NULL */
+	WriterConfirmProc		confirm;	/**< write the reserved tuple */
+	WriterCancelProc		cancel;		/**< release the reserved tuple */
 
 	MemoryContext		context;
 	int64				count;
@@ -59,6 +67,7 @@ struct Writer
 	bool			verbose;		/* output error message to server log? */
 	ON_DUPLICATE	on_duplicate;	/* behavior when duplicated keys found */
 	int64			max_dup_errors;	/* max ignorable errors in unique indexes */
+	INDEX_UPDATE	index_update;	/* how to update existing btree indexes */
 	char		   *dup_badfile;	/* duplicate error file name */
 	char		   *logfile;		/* log file name */
 	bool			multi_process;	/* multi process load? */
@@ -70,6 +79,16 @@ struct Writer
 	TupleChecker   *tchecker;		/**< tuple format checker */
 };
 
+/*
+ * reserve is optional.  It lets the parser form a tuple directly in a page of
+ * the writer, saving an allocation and a copy of the tuple.  It returns a
+ * tuple of len bytes whose t_data points to zeroed space in the page, or NULL
+ * if the tuple should be formed as usual.  confirm is called with the checked
+ * tuple, and writes the reserved one unless the checker replaced it.  cancel
+ * releases the space if the record is rejected.  The tuple is passed to insert
+ * later, but it must not be inserted again.
+ */
+
 typedef Writer *(*CreateWriter)(void *opt);
 
 extern Writer *CreateDirectWriter(void *opt);
@@ -79,11 +98,15 @@ extern Writer *CreateBinaryWriter(void *opt);
 
 extern Writer *WriterCreate(char *type, bool multi_process);
 extern void WriterInit(Writer *self);
+extern void WriterInsertBatch(Writer *self, HeapTuple *tuples, int ntuples);
 extern WriterResult WriterClose(Writer *self, bool onError);
 extern bool WriterParam(Writer *self, const char *keyword, char *value);
 extern void WriterDumpParams(Writer *self);
 
 #define WriterInsert(self, tuple)	((self)->insert((self), (tuple)))
+#define WriterReserve(self, len)	((self)->reserve((self), (len)))
+#define WriterConfirm(self, tuple)	((self)->confirm((self), (tuple)))
+#define WriterCancel(self)			((self)->cancel((self)))
 
 /*
  * Utilitiy functions
@@ -35,8 +35,11 @@ typedef struct BinaryParser
 	Parser	base;
 
 	Source		   *source;
+	READ_METHOD		read_method;	/**< how to read the input file */
 	Filter			filter;
 	TupleFormer		former;
+	List		   *dt_formats;	/**< list of DATETIME_FORMAT specs */
+	List		   *cache_name;	/**< list of VALUE_CACHE column names */
 
 	int64	offset;				/**< lines to skip */
 	int64	need_offset;		/**< lines to skip */
@@ -47,6 +50,10 @@ typedef struct BinaryParser
 	int		used_rec_cnt;		/**< # of returned records in buffer */
 	char	next_head;			/**< Preserved the head of next record */
 
+	char   *map;				/**< Input file mapped by the source, or NULL */
+	size_t	map_len;			/**< Length of the mapped input file */
+	size_t	map_pos;			/**< Offset of the next record in the map */
+
 	bool	preserve_blanks;	/**< preserve trailing spaces? */
 	int		nfield;				/**< number of fields */
 	Field  *fields;				/**< array of field descriptor */
@@ -101,6 +108,7 @@ BinaryParserInit(BinaryParser *self, Checker *checker, const char *infile, Tuple
 	int					i;
 	size_t				maxlen;
 	TupleCheckStatus	status;
+	ListCell		   *cell;
 
 	/*
 	 * set default values
@@ -114,7 +122,17 @@ BinaryParserInit(BinaryParser *self, Checker *checker, const char *infile, Tuple
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 						errmsg("no COL specified")));
 
-	self->source = CreateSource(infile, desc, multi_process);
+	if (list_length(self->dt_formats) > 0 && self->filter.funcstr)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("cannot use FILTER with DATETIME_FORMAT")));
+	if (list_length(self->cache_name) > 0 && self->filter.funcstr)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("cannot use FILTER with VALUE_CACHE")));
+
+	self->source = CreateSource(infile, desc, multi_process,
+								 self->read_method);
 
 	status = FilterInit(&self->filter, desc, collation);
 	if (checker->tchecker)
@@ -122,6 +140,12 @@ BinaryParserInit(BinaryParser *self, Checker *checker, const char *infile, Tuple
 
 	TupleFormerInit(&self->former, &self->filter, desc);
 
+	/* set date/time formats and value caches of the columns */
+	foreach(cell, self->dt_formats)
+		TupleFormerSetFormat(&self->former, lfirst(cell));
+	foreach(cell, self->cache_name)
+		TupleFormerSetCache(&self->former, lfirst(cell));
+
 	/*
 	 * Error if the number of input data fields is out of range to the number of
 	 * fields
@@ -156,7 +180,17 @@ BinaryParserInit(BinaryParser *self, Checker *checker, const char *infile, Tuple
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 			errmsg("STRIDE should be %ld or greater (%ld given)",
 				(long) maxlen, (long) self->rec_len)));
-	self->buffer = palloc(self->rec_len * READ_LINE_NUM + 1);
+
+	/*
+	 * Records in a mapped input file are read in place, but each record is
+	 * copied to the buffer because fields are terminated in place while
+	 * parsing.  This keeps the mapping unmodified.
+	 */
+	self->map = SourceMap(self->source, &self->map_len);
+	if (self->map != NULL)
+		self->buffer = palloc(self->rec_len + 1);
+	else
+		self->buffer = palloc(self->rec_len * READ_LINE_NUM + 1);
 }
 
 /**
@@ -215,7 +249,21 @@ BinaryParserRead(BinaryParser *self, Checker *checker)
 	int			i;
 
 	/* Skip first offset lines in the input file */
-	if (unlikely(self->need_offset > 0))
+	if (unlikely(self->need_offset > 0 && self->map != NULL))
+	{
+		if (self->map_len / self->rec_len < self->need_offset)
+		{
+			errno = EINVAL;
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not skip " int64_FMT " lines ("
+							int64_FMT " bytes) in the input file: %m",
+							self->need_offset,
+							self->rec_len * self->need_offset)));
+		}
+		self->map_pos = self->rec_len * self->need_offset;
+		self->need_offset = 0;
+	}
+	else if (unlikely(self->need_offset > 0))
 	{
 		int		i;
 
@@ -242,7 +290,25 @@ BinaryParserRead(BinaryParser *self, Checker *checker)
 	 * If the record buffer is exhausted, read next records from file
 	 * up to READ_LINE_NUM rows at once.
 	 */
-	if (self->used_rec_cnt >= self->total_rec_cnt)
+	if (self->map != NULL)
+	{
+		size_t	len = self->map_len - self->map_pos;
+
+		if (len < self->rec_len)
+		{
+			/* Trailing remainder bytes are ignored as well. */
+			if (len > 0)
+				elog(WARNING, "Ignore %d bytes at the end of file", (int) len);
+			self->map_pos = self->map_len;
+			return NULL;	/* eof */
+		}
+
+		record = self->buffer;
+		memcpy(record, self->map + self->map_pos, self->rec_len);
+		self->map_pos += self->rec_len;
+		SourceRelease(self->source, self->map_pos);
+	}
+	else if (self->used_rec_cnt >= self->total_rec_cnt)
 	{
 		int		len;
 		div_t	v;
@@ -315,7 +381,7 @@ BinaryParserRead(BinaryParser *self, Checker *checker)
 		tuple = FilterTuple(&self->filter, &self->former,
 							&self->base.parsing_field);
 	else
-		tuple = TupleFormerTuple(&self->former);
+		tuple = TupleFormerPlace(&self->former, checker->placer);
 
 	return tuple;
 }
@@ -350,6 +416,27 @@ BinaryParserParam(BinaryParser *self, const char *keyword, char *value)
 	{
 		ASSERT_ONCE(!self->filter.funcstr);
 		self->filter.funcstr = pstrdup(value);
+		/* FilterTuple returns the same tuple for each record */
+		self->base.reuse_tuple = true;
+	}
+	else if (CompareKeyword(keyword, "DATETIME_FORMAT"))
+	{
+		self->dt_formats = lappend(self->dt_formats, pstrdup(value));
+	}
+	else if (CompareKeyword(keyword, "VALUE_CACHE"))
+	{
+		self->cache_name = lappend(self->cache_name, pstrdup(value));
+	}
+	else if (CompareKeyword(keyword, "READ_METHOD"))
+	{
+		const READ_METHOD values[] =
+		{
+			READ_METHOD_BUFFERED,
+			READ_METHOD_DIRECT,
+			READ_METHOD_MMAP
+		};
+
+		self->read_method = values[choice(keyword, value, READ_METHOD_NAMES, lengthof(values))];
 	}
 	else
 		return false;	/* unknown parameter */
@@ -361,6 +448,7 @@ static void
 BinaryParserDumpParams(BinaryParser *self)
 {
 	StringInfoData	buf;
+	ListCell	   *cell;
 
 	initStringInfo(&buf);
 	appendStringInfoString(&buf, "TYPE = BINARY\n");
@@ -368,8 +456,16 @@ BinaryParserDumpParams(BinaryParser *self)
 	appendStringInfo(&buf, "STRIDE = %ld\n", (long) self->rec_len);
 	if (self->filter.funcstr)
 		appendStringInfo(&buf, "FILTER = %s\n", self->filter.funcstr);
+	if (self->read_method != READ_METHOD_BUFFERED)
+		appendStringInfo(&buf, "READ_METHOD = %s\n",
+						 READ_METHOD_NAMES[self->read_method]);
 
 	BinaryDumpParams(self->fields, self->nfield, &buf, "COL");
+	foreach(cell, self->dt_formats)
+		appendStringInfo(&buf, "DATETIME_FORMAT = %s\n",
+						 (char *) lfirst(cell));
+	foreach(cell, self->cache_name)
+		appendStringInfo(&buf, "VALUE_CACHE = %s\n", (char *) lfirst(cell));
 
 	LoggerLog(INFO, buf.data, 0);
 	pfree(buf.data);
@@ -379,7 +475,12 @@ static void
 BinaryParserDumpRecord(BinaryParser *self, FILE *fp, char *badfile)
 {
 	int		len;
-	char   *record = self->buffer + (self->rec_len * (self->used_rec_cnt - 1));
+	char   *record;
+
+	if (self->map != NULL)
+		record = self->buffer;
+	else
+		record = self->buffer + (self->rec_len * (self->used_rec_cnt - 1));
 
 	if (self->base.parsing_field > 0 && self->next_head != '\0')
 	{
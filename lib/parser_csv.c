@@ -10,6 +10,13 @@
  */
 #include "pg_bulkload.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#endif
+#endif
+
 #include "access/heapam.h"
 #include "access/htup.h"
 #include "executor/executor.h"
@@ -30,11 +37,144 @@
 #define INITIAL_BUF_LEN		(1024 * 1024)
 #define MAX_BUF_LEN			(16 * INITIAL_BUF_LEN)
 
+/*
+ * Structural scanner.
+ *
+ * Most characters in a CSV record are ordinary ones that the parser passes
+ * over without doing anything.  To skip them quickly, each 64-byte block of
+ * the record buffer is compared against the structural characters (delimiter,
+ * quote, escape, CR, LF and the '\0' sentinel) at once, and the result is kept
+ * as a bitmask in which bit k stands for the k-th byte of the block.  The
+ * parser then jumps from one set bit to the next.
+ *
+ * Blocks are aligned to SCAN_BLOCK_SIZE and bits before the current position
+ * are masked off, and the sentinel stops the scan before the bytes after the
+ * data matter.  Whole blocks are loaded nevertheless, so the record buffer
+ * must own every block it touches: a mapped input is page aligned, and a
+ * palloc'd buffer is allocated by allocRecordBuffer() aligned to and padded
+ * up to SCAN_BLOCK_SIZE.
+ */
+#define SCAN_BLOCK_SIZE		64
+#define SCAN_BLOCK(p)	\
+	((const char *) ((uintptr_t) (p) & ~((uintptr_t) SCAN_BLOCK_SIZE - 1)))
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_SSE2_SCAN
+#if defined(__clang__) || \
+	(defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define USE_AVX2_SCAN
+#endif
+#endif
+
+typedef uint64 (*CSVScanProc)(const char *block, const char *chars);
+
+#define SCAN_NCHARS		6		/* delimiter, quote, escape, CR, LF and '\0' */
+
+/*
+ * Parallel parsing.
+ *
+ * With PARSE_THREADS > 1, the mapped input file is split into ranges of about
+ * PARSE_RANGE_SIZE bytes, and worker threads tokenize them into records and
+ * unescaped fields.  Workers never call PostgreSQL functions.  The backend
+ * consumes the records in file order and only converts the fields into
+ * datums, so records are numbered exactly as in serial parsing.
+ *
+ * Whether a range begins inside a quoted field depends on all the data
+ * before it.  So each range is first scanned once for either initial state
+ * (phase A), and the actual state is resolved in file order from the end
+ * state of the preceding range.  Then the range is tokenized from its first
+ * record start (phase B); the record straddling the end of a range belongs to
+ * that range.  Range boundaries are moved forward until they do not follow a
+ * quote, an escape or a CR, so that the quote state is the only state carried
+ * across them.
+ */
+#define PARSE_RANGE_SIZE	(4 * 1024 * 1024)
+#define MAX_PARSE_THREADS	64
+
+typedef enum RangeState
+{
+	RANGE_EMPTY,
+	RANGE_SCANNING,		/* in phase A */
+	RANGE_SCANNED,
+	RANGE_TOKENIZING,	/* in phase B */
+	RANGE_DONE
+} RangeState;
+
+typedef enum CSVRecordError
+{
+	CSV_RECORD_OK,
+	CSV_RECORD_UNTERMINATED,	/* unterminated quoted field */
+	CSV_RECORD_NUL				/* '\0' in the data */
+} CSVRecordError;
+
+typedef struct CSVRecord
+{
+	int64			start;		/* offset of the record in the map */
+	int				len;		/* length of the record */
+	int				nfields;	/* number of fields, as parsing_field */
+	int64			field;		/* index of the first field */
+	CSVRecordError	error;
+} CSVRecord;
+
+typedef struct ParseRange
+{
+	RangeState	state;
+	int64		rangeno;
+	char	   *begin;
+	char	   *end;
+
+	/* results of phase A, indexed by the initial quote state */
+	bool		exit_quote[2];
+	char	   *first[2];		/* first record start, or end if none */
+
+	bool		in_quote;		/* resolved initial quote state */
+
+	/* results of phase B; the buffers are malloc'ed and reused */
+	CSVRecord  *records;
+	int64		nrecords;
+	int64		maxrecords;
+	int64	   *fields;			/* offset of each field in arena, or -1 */
+	int64		nfields;
+	int64		maxfields;
+	char	   *arena;			/* unescaped field values */
+	int64		arena_len;
+	int64		arena_size;
+	bool		oom;			/* out of memory in phase B */
+
+	int64		next;			/* record to be returned next */
+} ParseRange;
+
+typedef struct CSVParallel
+{
+	struct CSVParser   *parser;	/* read-only for workers */
+	bool		started;
+	char	   *base;			/* start of data after SKIP */
+	char	   *map_end;
+	int64		nranges;
+	int			nslots;
+	ParseRange *ranges;			/* range n is in slot n % nslots */
+	char		scan_chars[SCAN_NCHARS];	/* for phase A */
+
+	/* the members below are protected by lock */
+	int64		claim;			/* range to be scanned next */
+	int64		resolved;		/* range to be resolved next */
+	bool		exit_quote;		/* quote state at the end of resolved ranges */
+	int64		consume;		/* range being consumed by the backend */
+	bool		quit;
+
+	pthread_t	   *th;
+	int				nthreads;
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;		/* a range became ready for workers */
+	pthread_cond_t	done;		/* a range has been tokenized */
+} CSVParallel;
+
 typedef struct CSVParser
 {
 	Parser	base;
 
 	Source		   *source;
+	READ_METHOD		read_method;	/**< how to read the input file */
 	Filter			filter;
 	TupleFormer		former;
 
@@ -47,6 +187,7 @@ typedef struct CSVParser
 	 * This buffer stores the data read from the input file.
 	 */
 	char *rec_buf;
+	char *rec_alloc;	/**< palloc'd chunk holding rec_buf, or NULL */
 	
 	/**
 	 * @brief Field Buffer.
@@ -86,6 +227,24 @@ typedef struct CSVParser
 	 * @brief Pointer to the next record in the record buffer.
 	 */
 	char *next;
+
+	/**
+	 * @brief Length of the current record.
+	 *
+	 * Records are not terminated in the record buffer, so that a mapped input
+	 * file is not modified.
+	 */
+	int cur_len;
+
+	/**
+	 * @brief Input file mapped by the source, or NULL.
+	 *
+	 * If the source can map the input file, the record buffer points into the
+	 * mapping and records are parsed in place.  The field buffer is expanded
+	 * on demand instead of together with the record buffer.
+	 */
+	char *map;
+	char *map_end;
 	
 	/**
 	 * @brief Flag indicating EOF has been encountered in the input file.
@@ -104,7 +263,15 @@ typedef struct CSVParser
 	char		escape;			/**< escape letter */
 	char	   *null;			/**< NULL value string */
 	List	   *fnn_name;		/**< list of NOT NULL column names */
+	List	   *dt_formats;		/**< list of DATETIME_FORMAT specs */
+	List	   *cache_name;		/**< list of VALUE_CACHE column names */
 	bool	   *fnn;			/**< array of NOT NULL column flag */
+
+	CSVScanProc	scan;			/**< block scanner for this CPU */
+	char		scan_chars[SCAN_NCHARS];	/**< structural characters */
+
+	int			parse_threads;	/**< number of parse threads */
+	CSVParallel *parallel;		/**< parallel parsing state, or NULL */
 } CSVParser;
 
 static void	CSVParserInit(CSVParser *self, Checker *checker, const char *infile, TupleDesc desc, bool multi_process, Oid collation);
@@ -115,6 +282,184 @@ static void CSVParserDumpParams(CSVParser *self);
 static void CSVParserDumpRecord(CSVParser *self, FILE *fp, char *badfile);
 
 static void	ExtractValuesFromCSV(CSVParser *self, int parsed_field);
+static void	allocRecordBuffer(CSVParser *self, int used);
+
+static void CreateCSVParallel(CSVParser *self, int nthreads);
+static void CSVParallelStart(CSVParser *self);
+static void CSVParallelTerm(CSVParallel *par);
+static bool CSVParallelNext(CSVParser *self);
+static void *CSVParallelMain(void *arg);
+static char *rangeBoundary(CSVParallel *par, int64 rangeno);
+static void scanRange(CSVParallel *par, ParseRange *range);
+static void tokenizeRange(CSVParallel *par, ParseRange *range);
+static char *tokenizeRecord(CSVParallel *par, ParseRange *range, char *p);
+
+/*
+ * @brief Expand the field buffer to hold at least len bytes.
+ *
+ * Used only for a mapped input file, where the record buffer never grows.
+ */
+static void
+expandFieldBuffer(CSVParser *self, int len)
+{
+	int		j;
+	char   *old_buf = self->field_buf;
+
+	while (self->buf_len < len)
+		self->buf_len *= 2;
+	self->field_buf = repalloc(self->field_buf, self->buf_len);
+
+	/*
+	 * After repalloc(), address of each field needs to be adjusted.  Entries
+	 * after the current field are stale, but they are overwritten before use.
+	 */
+	for (j = 0; j < Max(self->former.maxfields, 1); j++)
+	{
+		if (self->fields[j])
+			self->fields[j] += self->field_buf - old_buf;
+	}
+}
+
+/*
+ * @brief Build the bitmask of structural characters in a block, one byte at a
+ * time.  Used if no SIMD implementation is available.
+ */
+static uint64
+scanBlockScalar(const char *block, const char *chars)
+{
+	uint64	mask = 0;
+	int		k;
+
+	for (k = 0; k < SCAN_BLOCK_SIZE; k++)
+	{
+		char	c = block[k];
+
+		if (c == chars[0] || c == chars[1] || c == chars[2] ||
+			c == chars[3] || c == chars[4] || c == chars[5])
+			mask |= UINT64CONST(1) << k;
+	}
+
+	return mask;
+}
+
+#ifdef USE_SSE2_SCAN
+/*
+ * @brief SSE2 version of scanBlockScalar(), 16 bytes per comparison.
+ * SSE2 is always available on x86-64.
+ */
+static uint64
+scanBlockSSE2(const char *block, const char *chars)
+{
+	uint64	mask = 0;
+	int		k;
+
+	for (k = 0; k < SCAN_BLOCK_SIZE; k += 16)
+	{
+		__m128i	v = _mm_load_si128((const __m128i *) (block + k));
+		__m128i	r;
+
+		r = _mm_cmpeq_epi8(v, _mm_set1_epi8(chars[0]));
+		r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(chars[1])));
+		r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(chars[2])));
+		r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(chars[3])));
+		r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(chars[4])));
+		r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(chars[5])));
+		mask |= (uint64) (uint32) _mm_movemask_epi8(r) << k;
+	}
+
+	return mask;
+}
+#endif
+
+#ifdef USE_AVX2_SCAN
+/*
+ * @brief AVX2 version of scanBlockScalar(), 32 bytes per comparison.
+ * Chosen at run time only if the CPU supports AVX2.
+ */
+__attribute__((target("avx2")))
+static uint64
+scanBlockAVX2(const char *block, const char *chars)
+{
+	uint64	mask = 0;
+	int		k;
+
+	for (k = 0; k < SCAN_BLOCK_SIZE; k += 32)
+	{
+		__m256i	v = _mm256_load_si256((const __m256i *) (block + k));
+		__m256i	r;
+
+		r = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chars[0]));
+		r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chars[1])));
+		r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chars[2])));
+		r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chars[3])));
+		r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chars[4])));
+		r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(chars[5])));
+		mask |= (uint64) (uint32) _mm256_movemask_epi8(r) << k;
+	}
+
+	return mask;
+}
+#endif
+
+/*
+ * @brief Choose the fastest block scanner for this CPU.
+ */
+static CSVScanProc
+chooseScanBlock(void)
+{
+#ifdef USE_AVX2_SCAN
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return scanBlockAVX2;
+#endif
+#ifdef USE_SSE2_SCAN
+	return scanBlockSSE2;
+#else
+	return scanBlockScalar;
+#endif
+}
+
+/*
+ * @brief Returns the first structural character at or after p.
+ *
+ * The bitmask of the last scanned block is cached in *block and *mask.  The
+ * caller must reset *block to NULL whenever the record buffer is modified.
+ */
+static inline char *
+nextStructural(CSVScanProc scan, const char *chars, char *p,
+			   const char **block, uint64 *mask)
+{
+	for (;;)
+	{
+		const char *b = SCAN_BLOCK(p);
+		uint64		m;
+
+		if (b != *block)
+		{
+			*mask = scan(b, chars);
+			*block = b;
+		}
+
+		m = *mask & (~UINT64CONST(0) << (p - b));
+		if (m != 0)
+		{
+#if defined(__GNUC__)
+			return (char *) b + __builtin_ctzll(m);
+#else
+			int		k = 0;
+
+			while ((m & 1) == 0)
+			{
+				m >>= 1;
+				k++;
+			}
+			return (char *) b + k;
+#endif
+		}
+
+		p = (char *) b + SCAN_BLOCK_SIZE;
+	}
+}
 
 /*
  * @brief Copies specified area in the record buffer to the field buffer.
@@ -138,6 +483,10 @@ static void	ExtractValuesFromCSV(CSVParser *self, int parsed_field);
 static void
 appendToField(CSVParser *self, int *dst, int *src, int len)
 {
+	/* room for the field, its terminator and the one after a delimiter */
+	if (unlikely(self->map != NULL && *dst + len + 2 > self->buf_len))
+		expandFieldBuffer(self, *dst + len + 2);
+
 	if (len)
 	{
 		memcpy(self->field_buf + *dst, self->rec_buf + *src, len);
@@ -151,6 +500,33 @@ appendToField(CSVParser *self, int *dst, int *src, int len)
 	(*src)++;
 }
 
+/*
+ * @brief (Re)allocates the record buffer of buf_len bytes.
+ *
+ * The buffer starts at a SCAN_BLOCK_SIZE boundary and the chunk extends to
+ * the end of its last block, so the structural scanner never loads bytes
+ * outside of it.  The chunk is zeroed so that the bytes after the data are
+ * defined, and the first used bytes of the old buffer are carried over.
+ */
+static void
+allocRecordBuffer(CSVParser *self, int used)
+{
+	char	   *chunk;
+	char	   *buf;
+
+	chunk = palloc0(self->buf_len + 2 * SCAN_BLOCK_SIZE);
+	buf = (char *) TYPEALIGN(SCAN_BLOCK_SIZE, chunk);
+
+	if (self->rec_alloc != NULL)
+	{
+		memcpy(buf, self->rec_buf, used);
+		pfree(self->rec_alloc);
+	}
+
+	self->rec_alloc = chunk;
+	self->rec_buf = buf;
+}
+
 /**
  * @brief Create a new CSV parser.
  */
@@ -183,6 +559,7 @@ static void
 CSVParserInit(CSVParser *self, Checker *checker, const char *infile, TupleDesc desc, bool multi_process, Oid collation)
 {
 	TupleCheckStatus	status;
+	size_t				map_len;
 
 	/*
 	 * set default values
@@ -211,8 +588,19 @@ CSVParserInit(CSVParser *self, Checker *checker, const char *infile, TupleDesc d
 				(errcode(ERRCODE_INTERNAL_ERROR),
 				 errmsg
 				 ("cannot use FILTER with FORCE_NOT_NULL")));
+	if (list_length(self->dt_formats) > 0 && self->filter.funcstr)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg
+				 ("cannot use FILTER with DATETIME_FORMAT")));
+	if (list_length(self->cache_name) > 0 && self->filter.funcstr)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg
+				 ("cannot use FILTER with VALUE_CACHE")));
 
-	self->source = CreateSource(infile, desc, multi_process);
+	self->source = CreateSource(infile, desc, multi_process,
+								 self->read_method);
 
 	status = FilterInit(&self->filter, desc, collation);
 	if (checker->tchecker)
@@ -220,6 +608,19 @@ CSVParserInit(CSVParser *self, Checker *checker, const char *infile, TupleDesc d
 
 	TupleFormerInit(&self->former, &self->filter, desc);
 
+	/*
+	 * set date/time formats and value caches of the columns
+	 */
+	do
+	{
+		ListCell   *cell;
+
+		foreach(cell, self->dt_formats)
+			TupleFormerSetFormat(&self->former, lfirst(cell));
+		foreach(cell, self->cache_name)
+			TupleFormerSetCache(&self->former, lfirst(cell));
+	} while(0);
+
 	/*
 	 * set not NULL column information
 	 */
@@ -250,8 +651,17 @@ CSVParserInit(CSVParser *self, Checker *checker, const char *infile, TupleDesc d
 	} while(0);
 
 	self->buf_len = INITIAL_BUF_LEN;
-	self->rec_buf = palloc(self->buf_len);
-	self->rec_buf[0] = '\0';
+	self->map = SourceMap(self->source, &map_len);
+	if (self->map != NULL)
+	{
+		self->map_end = self->map + map_len;
+		self->rec_buf = self->map;
+	}
+	else
+	{
+		allocRecordBuffer(self, 0);
+		self->rec_buf[0] = '\0';
+	}
 	self->used_len = 0;
 	self->field_buf = palloc(self->buf_len);
 	self->next = self->rec_buf;
@@ -259,6 +669,24 @@ CSVParserInit(CSVParser *self, Checker *checker, const char *infile, TupleDesc d
 	self->fields[0] = NULL;
 	self->null_len = strlen(self->null);
 	self->eof = false;
+
+	self->scan = chooseScanBlock();
+	self->scan_chars[0] = self->delim;
+	self->scan_chars[1] = self->quote;
+	self->scan_chars[2] = self->escape;
+	self->scan_chars[3] = '\r';
+	self->scan_chars[4] = '\n';
+	self->scan_chars[5] = '\0';
+
+	if (self->parse_threads > 1)
+	{
+		if (self->map == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("PARSE_THREADS requires READ_METHOD = MMAP")));
+
+		CreateCSVParallel(self, self->parse_threads);
+	}
 }
 
 /**
@@ -280,12 +708,15 @@ CSVParserTerm(CSVParser *self)
 
 	skip = self->offset;
 
+	/* stop the workers before the input is unmapped */
+	if (self->parallel)
+		CSVParallelTerm(self->parallel);
 	if (self->source)
 		SourceClose(self->source);
 	if (self->fields)
 		pfree(self->fields);
-	if (self->rec_buf)
-		pfree(self->rec_buf);
+	if (self->rec_alloc)
+		pfree(self->rec_alloc);
 	if (self->field_buf)
 		pfree(self->field_buf);
 	FilterTerm(&self->filter);
@@ -346,6 +777,8 @@ CSVParserRead(CSVParser *self, Checker *checker)
 	bool		need_data = false;		/* Flag indicating the need to read more characters */
 	bool		in_quote = false;
 	bool		inCR = false;
+	const char *scan_block = NULL;	/* block cached by nextStructural() */
+	uint64		scan_mask = 0;
 
 	/*
 	 * Field parsing info
@@ -369,7 +802,31 @@ CSVParserRead(CSVParser *self, Checker *checker)
 		int		skipped = 0;
 		bool	inCR = false;
 
-		while ((len = SourceRead(self->source, self->rec_buf, self->buf_len - 1)) > 0)
+		if (self->map != NULL)
+		{
+			char   *p;
+
+			for (p = self->next; p < self->map_end; p++)
+			{
+				if (*p == '\r')
+				{
+					if (p + 1 < self->map_end && p[1] == '\n')
+						p++;
+				}
+				else if (*p != '\n')
+					continue;
+
+				/* Skip the line */
+				if (++skipped >= self->need_offset)
+				{
+					/* Seek to head of the next line. */
+					self->next = p + 1;
+					goto skip_done;
+				}
+			}
+			len = 0;
+		}
+		else while ((len = SourceRead(self->source, self->rec_buf, self->buf_len - 1)) > 0)
 		{
 			int		i;
 
@@ -409,8 +866,32 @@ skip_done:
 		self->need_offset = 0;
 	}
 
+	if (self->parallel != NULL)
+	{
+		if (!self->parallel->started)
+			CSVParallelStart(self);
+
+		if (!CSVParallelNext(self))
+		{
+			self->eof = true;
+			return NULL;
+		}
+		goto parsed;
+	}
+
 	self->cur = self->next;
 
+	/*
+	 * A mapped input file is parsed in place.  Rebase the record buffer on the
+	 * current record to keep the indexes small, and let the source drop the
+	 * data behind it.
+	 */
+	if (self->map != NULL)
+	{
+		self->rec_buf = self->cur;
+		SourceRelease(self->source, self->cur - self->map);
+	}
+
 	/*
 	 * Initialize variables related to fied data.
 	 */
@@ -432,7 +913,28 @@ skip_done:
 		/*
 		 * If no record is found in the record buffer, read them from the input file.
 		 */
-		if (need_data)
+		if (need_data && self->map != NULL)
+		{
+			/*
+			 * The whole file is in the record buffer.  A '\0' before the end
+			 * of the mapping is in the data; otherwise we are at EOF.  An
+			 * escape character looks ahead at the next one.
+			 */
+			char	   *nul = self->rec_buf + i;
+
+			if (*nul != '\0')
+				nul++;
+			if (nul < self->map_end)
+			{
+				self->cur_len = nul - self->rec_buf;
+				self->next = nul + 1;
+				ereport(ERROR, (errcode(ERRCODE_CHARACTER_NOT_IN_REPERTOIRE),
+								errmsg("invalid byte sequence 0x00 in the input file")));
+			}
+			self->used_len = i;
+			ret = 0;
+		}
+		else if (need_data)
 		{
 			/*
 			 * When an escape character is found at the last of the buffer or no
@@ -457,6 +959,7 @@ skip_done:
 			else if (self->buf_len - self->used_len <= 1)
 			{
 				int			j;
+				int			old_len = self->buf_len;
 				char	   *old_buf = self->field_buf;
 
 				self->buf_len = Min(self->buf_len * 2, MAX_BUF_LEN);
@@ -470,7 +973,7 @@ skip_done:
 						self->fields[j] += self->field_buf - old_buf;
 				}
 
-				self->rec_buf = repalloc(self->rec_buf, self->buf_len);
+				allocRecordBuffer(self, old_len);
 				/*
 				 * Expanded buffer may be different from the original one, so we reset the
 				 * record beginning.
@@ -482,6 +985,10 @@ skip_done:
 			ret = SourceRead(self->source, self->rec_buf + self->used_len,
 								self->buf_len - self->used_len - 1);
 			BULKLOAD_PROFILE(&prof_reader_source);
+		}
+
+		if (need_data)
+		{
 			if (ret == 0)
 			{
 				self->eof = true;
@@ -504,6 +1011,7 @@ skip_done:
 					if (self->rec_buf[i - 1] == '\r')
 						i--;
 					self->rec_buf[i] = '\0';
+					self->cur_len = i - (self->cur - self->rec_buf);
 					break;
 				}
 
@@ -524,8 +1032,17 @@ skip_done:
 			self->used_len += ret;
 			self->rec_buf[self->used_len] = '\0';
 			need_data = false;
+			scan_block = NULL;
 		}
 
+		/*
+		 * Ordinary characters are no-ops below, except the first one of the
+		 * record, which is counted, and the one after CR.  Skip the others.
+		 */
+		if (!inCR && i > self->cur - self->rec_buf)
+			i = nextStructural(self->scan, self->scan_chars, self->rec_buf + i,
+							   &scan_block, &scan_mask) - self->rec_buf;
+
 		c = self->rec_buf[i];
 		if (c == '\0')
 		{
@@ -575,7 +1092,7 @@ skip_done:
 		{
 			appendToField(self, &dst, &src, i - src - 1);
 			checkFieldIsNull(self, field_num, i - field_head - 1);
-			self->rec_buf[i - 1] = '\0';
+			self->cur_len = i - 1 - (self->cur - self->rec_buf);
 
 			if (c != '\n')
 				i--;	/* re-read the char */
@@ -619,7 +1136,7 @@ skip_done:
 				 * Line feed other than a quote mark is the record delimiter.  Record parse
 				 * terminates when the record delmiter is found.
 				 */
-				self->rec_buf[i] = '\0';
+				self->cur_len = i - (self->cur - self->rec_buf);
 				self->next = self->rec_buf + i + 1;
 				break;
 			}
@@ -663,11 +1180,12 @@ skip_done:
 		ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
 						errmsg("unterminated CSV quoted field")));
 
+parsed:
 	/*
 	 * We accept a record only for new lines as input of the functions without
 	 * the arguments.
 	 */
-	if (self->former.maxfields == 0 && strlen(self->cur) == 0)
+	if (self->former.maxfields == 0 && self->cur_len == 0)
 		self->base.parsing_field = 0;
 
 	/*
@@ -714,7 +1232,7 @@ skip_done:
 		tuple = FilterTuple(&self->filter, &self->former,
 							&self->base.parsing_field);
 	else
-		tuple = TupleFormerTuple(&self->former);
+		tuple = TupleFormerPlace(&self->former, checker->placer);
 
 	return tuple;
 }
@@ -746,6 +1264,14 @@ CSVParserParam(CSVParser *self, const char *keyword, char *value)
 	{
 		self->fnn_name = lappend(self->fnn_name, pstrdup(value));
 	}
+	else if (CompareKeyword(keyword, "DATETIME_FORMAT"))
+	{
+		self->dt_formats = lappend(self->dt_formats, pstrdup(value));
+	}
+	else if (CompareKeyword(keyword, "VALUE_CACHE"))
+	{
+		self->cache_name = lappend(self->cache_name, pstrdup(value));
+	}
 	else if (CompareKeyword(keyword, "SKIP") ||
 			 CompareKeyword(keyword, "OFFSET"))
 	{
@@ -756,6 +1282,29 @@ CSVParserParam(CSVParser *self, const char *keyword, char *value)
 	{
 		ASSERT_ONCE(!self->filter.funcstr);
 		self->filter.funcstr = pstrdup(value);
+		/* FilterTuple returns the same tuple for each record */
+		self->base.reuse_tuple = true;
+	}
+	else if (CompareKeyword(keyword, "PARSE_THREADS"))
+	{
+		ASSERT_ONCE(self->parse_threads == 0);
+		self->parse_threads = ParseInt32(value, 1);
+		if (self->parse_threads > MAX_PARSE_THREADS)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("PARSE_THREADS must be between 1 and %d",
+							MAX_PARSE_THREADS)));
+	}
+	else if (CompareKeyword(keyword, "READ_METHOD"))
+	{
+		const READ_METHOD values[] =
+		{
+			READ_METHOD_BUFFERED,
+			READ_METHOD_DIRECT,
+			READ_METHOD_MMAP
+		};
+
+		self->read_method = values[choice(keyword, value, READ_METHOD_NAMES, lengthof(values))];
 	}
 	else
 		return false;	/* unknown parameter */
@@ -794,6 +1343,11 @@ CSVParserDumpParams(CSVParser *self)
 
 	if (self->filter.funcstr)
 		appendStringInfo(&buf, "FILTER = %s\n", self->filter.funcstr);
+	if (self->read_method != READ_METHOD_BUFFERED)
+		appendStringInfo(&buf, "READ_METHOD = %s\n",
+						 READ_METHOD_NAMES[self->read_method]);
+	if (self->parse_threads > 1)
+		appendStringInfo(&buf, "PARSE_THREADS = %d\n", self->parse_threads);
 
 	foreach(name, self->fnn_name)
 	{
@@ -801,6 +1355,11 @@ CSVParserDumpParams(CSVParser *self)
 		appendStringInfo(&buf, "FORCE_NOT_NULL = %s\n", str);
 		pfree(str);
 	}
+	foreach(name, self->dt_formats)
+		appendStringInfo(&buf, "DATETIME_FORMAT = %s\n",
+						 (char *) lfirst(name));
+	foreach(name, self->cache_name)
+		appendStringInfo(&buf, "VALUE_CACHE = %s\n", (char *) lfirst(name));
 
 	LoggerLog(INFO, buf.data, 0);
 	pfree(buf.data);
@@ -811,8 +1370,8 @@ CSVParserDumpRecord(CSVParser *self, FILE *fp, char *badfile)
 {
 	int	len;
 
-	len = fprintf(fp, "%s\n", self->cur);
-	if (len < strlen(self->cur) || fflush(fp))
+	len = fprintf(fp, "%.*s\n", self->cur_len, self->cur);
+	if (len < self->cur_len || fflush(fp))
 		ereport(ERROR,
 				(errcode_for_file_access(),
 				 errmsg("could not write parse badfile \"%s\": %m",
@@ -886,3 +1445,537 @@ ExtractValuesFromCSV(CSVParser *self, int parsed_field)
 		self->former.values[i] = self->filter.defaultValues[index];
 	}
 }
+
+/*
+ * Parallel parsing; see the comment for CSVParallel.
+ */
+
+static void
+CreateCSVParallel(CSVParser *self, int nthreads)
+{
+	CSVParallel	   *par = palloc0(sizeof(CSVParallel));
+
+	par->parser = self;
+	par->nthreads = nthreads;
+	par->nslots = nthreads * 2;
+	par->ranges = palloc0(sizeof(ParseRange) * par->nslots);
+	par->th = palloc0(sizeof(pthread_t) * nthreads);
+
+	/* phase A looks only at quotes, escapes and new lines */
+	par->scan_chars[0] = self->quote;
+	par->scan_chars[1] = self->escape;
+	par->scan_chars[2] = '\r';
+	par->scan_chars[3] = '\n';
+	par->scan_chars[4] = '\0';
+	par->scan_chars[5] = self->quote;
+
+	self->parallel = par;
+}
+
+/*
+ * Start worker threads.  Called at the first read, after SKIP is done.
+ */
+static void
+CSVParallelStart(CSVParser *self)
+{
+	CSVParallel	   *par = self->parallel;
+	int				nthreads = par->nthreads;
+	int				i;
+
+	par->base = self->next;
+	par->map_end = self->map_end;
+	par->nranges = (par->map_end - par->base + PARSE_RANGE_SIZE - 1) /
+				   PARSE_RANGE_SIZE;
+
+	pthread_mutex_init(&par->lock, NULL);
+	pthread_cond_init(&par->work, NULL);
+	pthread_cond_init(&par->done, NULL);
+	par->started = true;
+
+	par->nthreads = 0;
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&par->th[i], NULL, CSVParallelMain, par) != 0)
+			elog(ERROR, "pthread_create");
+		par->nthreads++;
+	}
+}
+
+static void
+CSVParallelTerm(CSVParallel *par)
+{
+	int		i;
+
+	if (par->started)
+	{
+		pthread_mutex_lock(&par->lock);
+		par->quit = true;
+		pthread_cond_broadcast(&par->work);
+		pthread_mutex_unlock(&par->lock);
+
+		for (i = 0; i < par->nthreads; i++)
+			pthread_join(par->th[i], NULL);
+
+		pthread_cond_destroy(&par->work);
+		pthread_cond_destroy(&par->done);
+		pthread_mutex_destroy(&par->lock);
+	}
+
+	for (i = 0; i < par->nslots; i++)
+	{
+		free(par->ranges[i].records);
+		free(par->ranges[i].fields);
+		free(par->ranges[i].arena);
+	}
+	pfree(par->ranges);
+	pfree(par->th);
+	pfree(par);
+}
+
+/*
+ * Set the next record to self->fields.  Returns false at EOF.
+ */
+static bool
+CSVParallelNext(CSVParser *self)
+{
+	CSVParallel	   *par = self->parallel;
+	ParseRange	   *range;
+	CSVRecord	   *rec;
+	int				i;
+	int				nfields;
+
+	for (;;)
+	{
+		if (par->consume >= par->nranges)
+			return false;
+
+		range = &par->ranges[par->consume % par->nslots];
+
+		/* wait for the range to be tokenized */
+		pthread_mutex_lock(&par->lock);
+		while (range->state != RANGE_DONE || range->rangeno != par->consume)
+		{
+			WaitForThread(&par->done, &par->lock);
+
+			pthread_mutex_unlock(&par->lock);
+			CHECK_FOR_INTERRUPTS();
+			pthread_mutex_lock(&par->lock);
+		}
+		pthread_mutex_unlock(&par->lock);
+
+		if (range->next < range->nrecords)
+			break;
+
+		if (range->oom)
+		{
+			self->base.parsing_field = -1;	/* cannot be ignored */
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("out of memory"),
+					 errdetail("Failed to tokenize CSV records in a worker thread.")));
+		}
+
+		/* the range is exhausted; give the slot back to the workers */
+		SourceRelease(self->source, range->end - self->map);
+		pthread_mutex_lock(&par->lock);
+		range->state = RANGE_EMPTY;
+		par->consume++;
+		pthread_cond_broadcast(&par->work);
+		pthread_mutex_unlock(&par->lock);
+	}
+
+	rec = &range->records[range->next++];
+
+	self->base.count++;
+	self->cur = self->map + rec->start;
+	self->cur_len = rec->len;
+	self->base.parsing_field = rec->nfields;
+
+	nfields = Min(rec->nfields, Max(self->former.maxfields, 1));
+	for (i = 0; i < nfields; i++)
+	{
+		int64	offset = range->fields[rec->field + i];
+
+		self->fields[i] = (offset < 0 ? NULL : range->arena + offset);
+	}
+
+	switch (rec->error)
+	{
+		case CSV_RECORD_OK:
+			break;
+		case CSV_RECORD_UNTERMINATED:
+			ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+							errmsg("unterminated CSV quoted field")));
+			break;
+		case CSV_RECORD_NUL:
+			ereport(ERROR, (errcode(ERRCODE_CHARACTER_NOT_IN_REPERTOIRE),
+							errmsg("invalid byte sequence 0x00 in the input file")));
+			break;
+	}
+
+	return true;
+}
+
+static void *
+CSVParallelMain(void *arg)
+{
+	CSVParallel	   *par = (CSVParallel *) arg;
+
+	pthread_mutex_lock(&par->lock);
+
+	while (!par->quit)
+	{
+		ParseRange *range = NULL;
+		int64		r;
+
+		/* tokenize the oldest resolved range first */
+		for (r = par->consume; r < par->resolved; r++)
+		{
+			if (par->ranges[r % par->nslots].state == RANGE_SCANNED)
+			{
+				range = &par->ranges[r % par->nslots];
+				break;
+			}
+		}
+
+		if (range != NULL)
+		{
+			range->state = RANGE_TOKENIZING;
+			pthread_mutex_unlock(&par->lock);
+
+			tokenizeRange(par, range);
+
+			pthread_mutex_lock(&par->lock);
+			range->state = RANGE_DONE;
+			pthread_cond_broadcast(&par->done);
+			continue;
+		}
+
+		/* otherwise scan the next range if its slot is free */
+		if (par->claim < par->nranges &&
+			par->claim < par->consume + par->nslots)
+		{
+			range = &par->ranges[par->claim % par->nslots];
+			range->rangeno = par->claim++;
+			range->state = RANGE_SCANNING;
+			range->begin = rangeBoundary(par, range->rangeno);
+			range->end = rangeBoundary(par, range->rangeno + 1);
+			pthread_mutex_unlock(&par->lock);
+
+			scanRange(par, range);
+
+			pthread_mutex_lock(&par->lock);
+			range->state = RANGE_SCANNED;
+
+			/* resolve the initial quote states in file order */
+			while (par->resolved < par->claim)
+			{
+				range = &par->ranges[par->resolved % par->nslots];
+				if (range->state != RANGE_SCANNED)
+					break;
+
+				range->in_quote = (range->rangeno > 0 && par->exit_quote);
+				par->exit_quote = range->exit_quote[range->in_quote];
+				par->resolved++;
+			}
+			pthread_cond_broadcast(&par->work);
+			continue;
+		}
+
+		pthread_cond_wait(&par->work, &par->lock);
+	}
+
+	pthread_mutex_unlock(&par->lock);
+
+	return NULL;
+}
+
+/*
+ * Returns the beginning of the range.  See the comment for CSVParallel.
+ */
+static char *
+rangeBoundary(CSVParallel *par, int64 rangeno)
+{
+	CSVParser  *self = par->parser;
+	char	   *p;
+
+	if (rangeno <= 0)
+		return par->base;
+	if (rangeno >= par->nranges)
+		return par->map_end;
+
+	p = par->base + rangeno * PARSE_RANGE_SIZE;
+	while (p < par->map_end &&
+		   (p[-1] == self->quote || p[-1] == self->escape || p[-1] == '\r'))
+		p++;
+
+	return p;
+}
+
+/*
+ * Phase A: find the first record start and the quote state at the end of the
+ * range for either initial quote state.  The transitions must match those in
+ * tokenizeRecord().
+ */
+static void
+scanRange(CSVParallel *par, ParseRange *range)
+{
+	CSVParser  *self = par->parser;
+	int			s;
+
+	for (s = 0; s < 2; s++)
+	{
+		bool		in_quote = (s != 0);
+		char	   *p = range->begin;
+		char	   *first = NULL;
+		const char *block = NULL;
+		uint64		mask = 0;
+
+		if (range->rangeno == 0 || (!in_quote && p[-1] == '\n'))
+			first = p;
+
+		while (p < range->end)
+		{
+			char	c;
+
+			p = nextStructural(self->scan, par->scan_chars, p, &block, &mask);
+			if (p >= range->end)
+				break;
+
+			c = *p;
+			if (in_quote)
+			{
+				if (c == self->escape &&
+					(p[1] == self->quote || p[1] == self->escape))
+					p++;
+				else if (c == self->quote)
+					in_quote = false;
+			}
+			else if (c == self->quote)
+				in_quote = true;
+			else if (c == '\r' || c == '\n')
+			{
+				if (c == '\r' && p[1] == '\n')
+					p++;
+				if (first == NULL)
+					first = p + 1;
+			}
+			p++;
+		}
+
+		range->exit_quote[s] = in_quote;
+		range->first[s] = (first != NULL ? Min(first, range->end) : range->end);
+	}
+}
+
+/*
+ * Phase B: tokenize all records starting in the range.
+ */
+static void
+tokenizeRange(CSVParallel *par, ParseRange *range)
+{
+	char   *p = range->first[range->in_quote];
+
+	range->nrecords = 0;
+	range->nfields = 0;
+	range->arena_len = 0;
+	range->oom = false;
+	range->next = 0;
+
+	while (p < range->end)
+	{
+		if ((p = tokenizeRecord(par, range, p)) == NULL)
+		{
+			range->oom = true;
+			break;
+		}
+	}
+}
+
+/*
+ * Enlarge a malloc'ed array to hold needed elements.
+ */
+static bool
+reserveArray(void **array, int64 *max, int64 needed, size_t size)
+{
+	int64	newmax;
+	void   *newarray;
+
+	if (needed <= *max)
+		return true;
+
+	newmax = Max(*max * 2, Max(needed, 1024));
+	if ((newarray = realloc(*array, newmax * size)) == NULL)
+		return false;
+
+	*array = newarray;
+	*max = newmax;
+	return true;
+}
+
+/*
+ * Append a part of a field value to the arena, and terminate the value if
+ * the field ends.
+ */
+static bool
+appendToArena(ParseRange *range, const char *src, int64 len, bool terminate)
+{
+	if (!reserveArray((void **) &range->arena, &range->arena_size,
+					  range->arena_len + len + 1, sizeof(char)))
+		return false;
+
+	memcpy(range->arena + range->arena_len, src, len);
+	range->arena_len += len;
+	if (terminate)
+		range->arena[range->arena_len++] = '\0';
+	return true;
+}
+
+/*
+ * Tokenize a record in the same way as CSVParserRead() and return the start of
+ * the next record, or NULL if out of memory.
+ */
+static char *
+tokenizeRecord(CSVParallel *par, ParseRange *range, char *p)
+{
+	CSVParser  *self = par->parser;
+	int			nslots = Max(self->former.maxfields, 1);
+	CSVRecord  *rec;
+	int64	   *fields;
+	char	   *cur = p;		/* beginning of the record */
+	char	   *src = p;		/* next character to copy */
+	char	   *field_head = p;	/* beginning of the current field */
+	char	   *next;
+	int			field_num = 0;
+	bool		in_quote = false;
+	const char *block = NULL;
+	uint64		mask = 0;
+
+	if (!reserveArray((void **) &range->records, &range->maxrecords,
+					  range->nrecords + 1, sizeof(CSVRecord)) ||
+		!reserveArray((void **) &range->fields, &range->maxfields,
+					  range->nfields + nslots, sizeof(int64)))
+		return NULL;
+
+	rec = &range->records[range->nrecords];
+	rec->start = cur - self->map;
+	rec->nfields = 1;
+	rec->field = range->nfields;
+	rec->error = CSV_RECORD_OK;
+	fields = range->fields + rec->field;
+	fields[0] = range->arena_len;
+
+	for (;;)
+	{
+		char	c;
+
+		p = nextStructural(self->scan, self->scan_chars, p, &block, &mask);
+		c = *p;
+
+		if (c == '\0')
+		{
+			if (p < par->map_end)
+			{
+				/* '\0' in the data; find the end of the record anyway */
+				rec->error = CSV_RECORD_NUL;
+				p++;
+				continue;
+			}
+
+			if (in_quote)
+			{
+				/* Record string does not include a new line of the end. */
+				char   *end = p;
+
+				if (end > cur && end[-1] == '\n')
+					end--;
+				if (end > cur && end[-1] == '\r')
+					end--;
+				rec->len = end - cur;
+				if (rec->error == CSV_RECORD_OK)
+					rec->error = CSV_RECORD_UNTERMINATED;
+				next = p;
+				break;
+			}
+
+			/* the last line without a new line */
+			c = '\n';
+		}
+		else if (in_quote)
+		{
+			if (c == self->escape)
+			{
+				if (p[1] == self->quote || p[1] == self->escape)
+				{
+					/* keep the escaped character */
+					if (!appendToArena(range, src, p - src, false))
+						return NULL;
+					src = p + 1;
+					p += 2;
+					continue;
+				}
+				else if (p[1] == '\0' && p + 1 >= par->map_end)
+				{
+					/* EOF just after an escape is treated as unterminated */
+					p++;
+					continue;
+				}
+			}
+
+			if (c == self->quote)
+			{
+				if (!appendToArena(range, src, p - src, false))
+					return NULL;
+				src = p + 1;
+				in_quote = false;
+			}
+			p++;
+			continue;
+		}
+		else if (c == self->quote)
+		{
+			if (!appendToArena(range, src, p - src, false))
+				return NULL;
+			src = p + 1;
+			in_quote = true;
+			p++;
+			continue;
+		}
+
+		if (c == self->delim || c == '\r' || c == '\n')
+		{
+			/* end of the field */
+			if (!appendToArena(range, src, p - src, true))
+				return NULL;
+
+			if (self->former.maxfields != 0 &&
+				!self->fnn[self->former.attnum[field_num]] &&
+				self->null_len == p - field_head &&
+				memcmp(self->null, range->arena + fields[field_num],
+					   self->null_len) == 0)
+				fields[field_num] = -1;
+
+			if (c != self->delim)
+			{
+				/* end of the record */
+				rec->len = p - cur;
+				if (c == '\r' && p[1] == '\n')
+					p++;
+				next = Min(p + 1, par->map_end);
+				break;
+			}
+
+			if (field_num + 1 < self->former.maxfields)
+				field_num++;
+			rec->nfields++;
+			field_head = src = p + 1;
+			fields[field_num] = range->arena_len;
+		}
+		p++;
+	}
+
+	range->nrecords++;
+	range->nfields += nslots;
+
+	return next;
+}
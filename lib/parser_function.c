@@ -72,6 +72,7 @@ CreateFunctionParser(void)
 	self->base.param = (ParserParamProc) FunctionParserParam;
 	self->base.dumpParams = (ParserDumpParamsProc) FunctionParserDumpParams;
 	self->base.dumpRecord = (ParserDumpRecordProc) FunctionParserDumpRecord;
+	self->base.reuse_tuple = true;
 
 	return (Parser *)self;
 }
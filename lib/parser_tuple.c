@@ -47,6 +47,7 @@ CreateTupleParser(void)
 	self->base.param = (ParserParamProc) TupleParserParam;
 	self->base.dumpParams = (ParserDumpParamsProc) TupleParserDumpParams;
 	self->base.dumpRecord = (ParserDumpRecordProc) TupleParserDumpRecord;
+	self->base.reuse_tuple = true;
 
 	return (Parser *)self;
 }
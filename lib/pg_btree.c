@@ -10,6 +10,8 @@
  */
 #include "pg_bulkload.h"
 
+#include <math.h>
+
 #include "access/genam.h"
 #include "access/heapam.h"
 #include "access/nbtree.h"
@@ -18,6 +20,9 @@
 #include "catalog/index.h"
 #include "catalog/pg_am.h"
 #include "executor/executor.h"
+#include "miscadmin.h"
+#include "optimizer/cost.h"
+#include "storage/buffile.h"
 #include "storage/fd.h"
 #include "storage/lmgr.h"
 #include "storage/smgr.h"
@@ -98,23 +103,72 @@ typedef struct BTReader
 	char			   *page;	/**< Cached page */
 } BTReader;
 
+/**
+ * @brief Spool that skips sorting while tuples come in key order
+ *
+ * Tuples are kept in a sequential run as long as each one is not less than
+ * the previous one, and moved to the tuplesort when the order breaks.  The run
+ * stays in memory up to maintenance_work_mem, which the tuplesort does not use
+ * until then, and is written to a temporary file when it grows larger.  The
+ * spool must be the first member because the spool is freed by
+ * _bt_spooldestroy.
+ */
+typedef struct BTSortedSpool
+{
+	BTSpool			spool;		/**< spool to sort tuples */
+	bool			sorted;		/**< tuples are still in key order? */
+	bool			enforce;	/**< raise errors for duplicate keys? */
+	IndexTuple	   *tuples;		/**< tuples in key order in memory */
+	int				ntuples;	/**< number of tuples in memory */
+	int				maxtuples;	/**< allocated length of tuples */
+	int				current;	/**< next tuple to read from memory */
+	long			availMem;	/**< remaining memory for the run */
+	BufFile		   *run;		/**< tuples in key order on disk, or NULL */
+	long			runlen;		/**< bytes written to run */
+	IndexTuple		last;		/**< copy of the last tuple in the run */
+	Size			lastlen;	/**< allocated size of last */
+	ScanKey			scankey;	/**< scan key to compare tuples */
+	MemoryContext	context;	/**< context for the above */
+} BTSortedSpool;
+
 static BTSpool **IndexSpoolBegin(ResultRelInfo *relinfo, bool enforceUnique);
 static void IndexSpoolEnd(Spooler *self);
 static void IndexSpoolInsert(BTSpool **spools, TupleTableSlot *slot, ItemPointer tupleid, EState *estate);
 
 static IndexTuple BTSpoolGetNextItem(BTSpool *spool, IndexTuple itup, bool *should_free);
+static BTSpool *BTSpoolWrap(BTSpool *spool, bool enforce);
+static void BTSpoolAdd(BTSpool *spool, IndexTuple itup, Datum *values, bool *isnull);
+static void BTSpoolPerformSort(BTSpool *spool);
+static void BTSpoolDestroy(BTSpool *spool);
+static void BTSpoolSortRun(BTSortedSpool *spool);
+static void BTSpoolSpillRun(BTSortedSpool *spool);
+static void BTSpoolWriteRun(BTSortedSpool *spool, IndexTuple itup);
+static IndexTuple BTSpoolReadRun(BTSortedSpool *spool);
 static bool BTReaderInit(BTReader *reader, Relation rel);
 static void BTReaderTerm(BTReader *reader);
 static void BTReaderReadPage(BTReader *reader, BlockNumber blkno);
 static IndexTuple BTReaderGetNextItem(BTReader *reader);
+static IndexTuple BTReaderGetLastItem(BTReader *reader);
+static bool BTReaderIsBefore(BTReader *reader, Relation rel, IndexTuple itup);
 
 static void _bt_mergebuild(Spooler *self, BTSpool *btspool);
+static bool _bt_useinsert(Spooler *self, BTSpool *btspool);
+static bool _bt_useappend(Spooler *self, Relation index);
+static void _bt_insertload(Spooler *self, BTSpool *btspool, Relation heapRel,
+						   IndexTuple itup, bool should_free);
 static void _bt_mergeload(Spooler *self, BTWriteState *wstate, BTSpool *btspool,
-						  BTReader *btspool2, Relation heapRel);
+						  BTReader *btspool2, Relation heapRel,
+						  IndexTuple itup, bool should_free);
 static int compare_indextuple(const IndexTuple itup1, const IndexTuple itup2,
 	ScanKey entry, int keysz, TupleDesc tupdes, bool *hasnull);
 static bool heap_is_visible(Relation heapRel, ItemPointer htid);
 static void remove_duplicate(Spooler *self, Relation heap, IndexTuple itup, const char *relname);
+#ifdef ENABLE_BULKLOAD_PROFILE
+static void profile_spool(BTSpool *btspool, const char *build);
+#define BULKLOAD_PROFILE_SPOOL(spool, build)	profile_spool((spool), (build))
+#else
+#define BULKLOAD_PROFILE_SPOOL(spool, build)	((void) 0)
+#endif
 
 
 void
@@ -123,11 +177,14 @@ SpoolerOpen(Spooler *self,
 			bool use_wal,
 			ON_DUPLICATE on_duplicate,
 			int64 max_dup_errors,
-			const char *dup_badfile)
+			const char *dup_badfile,
+			INDEX_UPDATE index_update)
 {
 	memset(self, 0, sizeof(Spooler));
 
 	self->on_duplicate = on_duplicate;
+	self->index_update = index_update;
+	self->spooled = 0;
 	self->use_wal = use_wal;
 	self->max_dup_errors = max_dup_errors;
 	self->dup_old = 0;
@@ -154,6 +211,14 @@ SpoolerOpen(Spooler *self,
 
 	self->slot = MakeSingleTupleTableSlot(RelationGetDescr(rel));
 
+	/*
+	 * Indexes of an empty relfilenode created in this transaction, ex. by
+	 * TRUNCATE, are known to be empty.
+	 */
+	self->empty = (RelationGetNumberOfBlocks(rel) == 0 &&
+		(rel->rd_createSubid != InvalidSubTransactionId ||
+		 rel->rd_newRelfilenodeSubid != InvalidSubTransactionId));
+
 	self->spools = IndexSpoolBegin(self->relinfo,
 								   max_dup_errors == 0);
 }
@@ -187,6 +252,7 @@ SpoolerInsert(Spooler *self, HeapTuple tuple)
 	/* Spool keys in the tuple */
 	ExecStoreTuple(tuple, self->slot, InvalidBuffer, false);
 	IndexSpoolInsert(self->spools, self->slot, &(tuple->t_self), self->estate);
+	self->spooled++;
 	BULKLOAD_PROFILE(&prof_writer_index);
 }
 
@@ -224,6 +290,8 @@ IndexSpoolBegin(ResultRelInfo *relinfo, bool enforceUnique)
 					false);
 #endif
 
+			spools[i] = BTSpoolWrap(spools[i], enforceUnique ?
+									indices[i]->rd_index->indisunique : false);
 			spools[i]->isunique = indices[i]->rd_index->indisunique;
 		}
 		else
@@ -254,7 +322,7 @@ IndexSpoolEnd(Spooler *self)
 		if (spools[i] != NULL)
 		{
 			_bt_mergebuild(self, spools[i]);
-			_bt_spooldestroy(spools[i]);
+			BTSpoolDestroy(spools[i]);
 		}
 		else
 		{
@@ -357,11 +425,7 @@ IndexSpoolInsert(BTSpool **spools, TupleTableSlot *slot, ItemPointer tupleid, ES
 		/* Spool the tuple. */
 		itup = index_form_tuple(RelationGetDescr(indices[i]), values, isnull);
 		itup->t_tid = *tupleid;
-#if PG_VERSION_NUM >= 90500
-		_bt_spool(spools[i], &itup->t_tid, values, isnull);
-#else
-		_bt_spool(itup, spools[i]);
-#endif
+		BTSpoolAdd(spools[i], itup, values, isnull);
 		pfree(itup);
 	}
 }
@@ -374,11 +438,23 @@ _bt_mergebuild(Spooler *self, BTSpool *btspool)
 	BTWriteState	wstate;
 	BTReader		reader;
 	bool			merge;
+	bool			merge_spool;
+	IndexTuple		itup = NULL;
+	bool			should_free = false;
 
 	Assert(btspool->index->rd_index->indisvalid);
 
-	tuplesort_performsort(btspool->sortstate);
+	BTSpoolPerformSort(btspool);
 
+	if (_bt_useinsert(self, btspool))
+	{
+		LockRelation(btspool->index, AccessExclusiveLock);
+		itup = BTSpoolGetNextItem(btspool, NULL, &should_free);
+		_bt_insertload(self, btspool, heapRel, itup, should_free);
+		BULKLOAD_PROFILE_SPOOL(btspool, "INSERT");
+		BULKLOAD_PROFILE(&prof_merge);
+		return;
+	}
 
 #if PG_VERSION_NUM >= 90300
 	/*
@@ -410,16 +486,59 @@ _bt_mergebuild(Spooler *self, BTSpool *btspool)
 	wstate.btws_pages_written = 0;
 	wstate.btws_zeropage = NULL;	/* until needed */
 
+	LockRelation(wstate.index, AccessExclusiveLock);
+
+	if (self->empty)
+	{
+		/* No need to read the empty index; the reader returns no items. */
+		memset(&reader, 0, sizeof(reader));
+		reader.blkno = InvalidBlockNumber;
+		merge = false;
+	}
+	else
+	{
+		/*
+		 * Flush dirty buffers so that we will read the index files directly
+		 * in order to get pre-existing data. We must acquire
+		 * AccessExclusiveLock for the target table for calling
+		 * FlushRelationBuffer().
+		 */
+		FlushRelationBuffers(wstate.index);
+		BULKLOAD_PROFILE(&prof_flush);
+
+		merge = BTReaderInit(&reader, wstate.index);
+	}
+
 	/*
-	 * Flush dirty buffers so that we will read the index files directly
-	 * in order to get pre-existing data. We must acquire AccessExclusiveLock
-	 * for the target table for calling FlushRelationBuffer().
+	 * _bt_load reads the tuplesort directly, so a presorted run is loaded
+	 * by the merge with the empty reader.
 	 */
-	LockRelation(wstate.index, AccessExclusiveLock);
-	FlushRelationBuffers(wstate.index);
-	BULKLOAD_PROFILE(&prof_flush);
+	if (((BTSortedSpool *) btspool)->sorted)
+		merge_spool = true;
+	else
+		merge_spool = (merge ||
+					   (btspool->isunique && self->max_dup_errors > 0));
 
-	merge = BTReaderInit(&reader, wstate.index);
+	if (merge_spool)
+		itup = BTSpoolGetNextItem(btspool, NULL, &should_free);
+
+	/*
+	 * If all new keys follow the last key in the old index, as serial or
+	 * time-series keys do, insertion only extends the right edge of the
+	 * index.  It costs O(new tuples) while the merge rewrites all old ones,
+	 * but each tuple is WAL-logged, so it is used only if it is cheaper.
+	 */
+	if (merge && self->index_update == INDEX_UPDATE_AUTO &&
+		!(btspool->isunique && self->max_dup_errors > 0) &&
+		_bt_useappend(self, wstate.index) &&
+		BTReaderIsBefore(&reader, wstate.index, itup))
+	{
+		BTReaderTerm(&reader);
+		_bt_insertload(self, btspool, heapRel, itup, should_free);
+		BULKLOAD_PROFILE_SPOOL(btspool, "INSERT");
+		BULKLOAD_PROFILE(&prof_merge);
+		return;
+	}
 
 	elog(DEBUG1, "pg_bulkload: build \"%s\" %s merge (%s wal)",
 		RelationGetRelationName(wstate.index),
@@ -429,34 +548,185 @@ _bt_mergebuild(Spooler *self, BTSpool *btspool)
 	/* Assign a new file node. */
 	RelationSetNewRelfilenode(wstate.index, InvalidTransactionId);
 
-	if (merge || (btspool->isunique && self->max_dup_errors > 0))
+	if (merge_spool)
 	{
 		/* Merge two streams into the new file node that we assigned. */
 		BULKLOAD_PROFILE_PUSH();
-		_bt_mergeload(self, &wstate, btspool, &reader, heapRel);
+		_bt_mergeload(self, &wstate, btspool, &reader, heapRel,
+					  itup, should_free);
 		BULKLOAD_PROFILE_POP();
+		BULKLOAD_PROFILE_SPOOL(btspool, "MERGE");
 		BULKLOAD_PROFILE(&prof_merge);
 	}
 	else
 	{
 		/* Fast path for newly created index. */
 		_bt_load(&wstate, btspool, NULL);
+		BULKLOAD_PROFILE_SPOOL(btspool, "INDEX");
 		BULKLOAD_PROFILE(&prof_index);
 	}
 
-	BTReaderTerm(&reader);
+	if (!self->empty)
+		BTReaderTerm(&reader);
+}
+
+/*
+ * _bt_useinsert - Decide whether to insert the spooled tuples into the
+ * existing index instead of rebuilding it.
+ *
+ * A rebuild reads and writes all pages of the old index sequentially, while
+ * sorted insertion reads at most one leaf page at random per spooled tuple.
+ * Unique indexes are always rebuilt if duplicates are allowed, because only
+ * the merge removes them.
+ */
+static bool
+_bt_useinsert(Spooler *self, BTSpool *btspool)
+{
+	BlockNumber		nblocks;
+
+	if (self->empty || (btspool->isunique && self->max_dup_errors > 0))
+		return false;
+
+	switch (self->index_update)
+	{
+		case INDEX_UPDATE_REBUILD:
+			return false;
+		case INDEX_UPDATE_INSERT:
+			return true;
+		default:
+			break;
+	}
+
+	nblocks = RelationGetNumberOfBlocks(btspool->index);
+	return self->spooled * random_page_cost < 2.0 * nblocks * seq_page_cost;
+}
+
+/*
+ * _bt_useappend - Decide whether appending the spooled tuples to the right
+ * edge of the index is cheaper than rebuilding it.
+ *
+ * An appended tuple needs no random read because the right-most path stays
+ * in shared buffers, but it costs a descent of the tree and a WAL record.
+ * A rebuild reads and writes all pages of the old index sequentially.
+ */
+static bool
+_bt_useappend(Spooler *self, Relation index)
+{
+	BlockNumber		nblocks = RelationGetNumberOfBlocks(index);
+	double			ntuples = Max(index->rd_rel->reltuples, 2.0);
+	double			cost;
+
+	/* comparisons in the descent, the index tuple and the WAL record */
+	cost = cpu_operator_cost * (log(ntuples) / log(2.0)) +
+		   cpu_index_tuple_cost + cpu_tuple_cost;
+
+	return self->spooled * cost < 2.0 * nblocks * seq_page_cost;
+}
+
+/*
+ * _bt_insertload - Insert sorted tuples in the spool into the existing index.
+ * itup is the first tuple that has been taken from the spool.
+ *
+ * Insertions are WAL-logged as usual.  Heap tuples they point to are already
+ * flushed, and stay on disk as dead tuples if the load is aborted.
+ */
+static void
+_bt_insertload(Spooler *self, BTSpool *btspool, Relation heapRel,
+			   IndexTuple itup, bool should_free)
+{
+	MemoryContext	context;
+	MemoryContext	oldcxt;
+
+	elog(DEBUG1, "pg_bulkload: insert into \"%s\"",
+		RelationGetRelationName(btspool->index));
+
+	context = AllocSetContextCreate(CurrentMemoryContext,
+									"InsertLoad",
+									ALLOCSET_DEFAULT_MINSIZE,
+									ALLOCSET_DEFAULT_INITSIZE,
+									ALLOCSET_DEFAULT_MAXSIZE);
+
+	for (; itup != NULL; itup = BTSpoolGetNextItem(btspool, itup, &should_free))
+	{
+		oldcxt = MemoryContextSwitchTo(context);
+#if PG_VERSION_NUM >= 90000
+		_bt_doinsert(btspool->index, itup,
+					 btspool->isunique ? UNIQUE_CHECK_YES : UNIQUE_CHECK_NO,
+					 heapRel);
+#else
+		_bt_doinsert(btspool->index, itup, btspool->isunique, heapRel);
+#endif
+		MemoryContextSwitchTo(oldcxt);
+		MemoryContextReset(context);
+	}
+
+	MemoryContextDelete(context);
 }
 
+#ifdef ENABLE_BULKLOAD_PROFILE
+/*
+ * profile_spool - Remember how the spool was sorted and which build counted
+ * in prof_index or prof_merge used it, for the profile output.
+ *
+ * The spool quicksorts and writes out runs while rows are loaded whenever it
+ * exceeds its memory, so "external merge" means only the merge of the runs
+ * was left after the last row, and the disk space is the size of the runs.
+ * The number of runs is private to tuplesort and not reported.
+ */
+static void
+profile_spool(BTSpool *btspool, const char *build)
+{
+	MemoryContext	oldcxt;
+	StringInfoData	buf;
+#if PG_VERSION_NUM >= 90000
+	const char	   *sortMethod;
+	const char	   *spaceType;
+	long			spaceUsed;
+#endif
+
+	oldcxt = MemoryContextSwitchTo(TopTransactionContext);
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "%s: %s, ",
+					 RelationGetRelationName(btspool->index), build);
+	if (((BTSortedSpool *) btspool)->sorted)
+	{
+		BTSortedSpool  *sspool = (BTSortedSpool *) btspool;
+
+		if (sspool->run != NULL)
+			appendStringInfo(&buf, "presorted run, Disk: %ldkB",
+							 (sspool->runlen + 1023) / 1024);
+		else
+			appendStringInfo(&buf, "presorted run, Memory: %ldkB",
+							 (maintenance_work_mem * 1024L -
+							  sspool->availMem + 1023) / 1024);
+	}
+	else
+	{
+#if PG_VERSION_NUM >= 90000
+		tuplesort_get_stats(btspool->sortstate,
+							&sortMethod, &spaceType, &spaceUsed);
+		appendStringInfo(&buf, "%s, %s: %ldkB",
+						 sortMethod, spaceType, spaceUsed);
+#else
+		appendStringInfoString(&buf, tuplesort_explain(btspool->sortstate));
+#endif
+	}
+	prof_spools = lappend(prof_spools, buf.data);
+	MemoryContextSwitchTo(oldcxt);
+}
+#endif
+
 /*
  * _bt_mergeload - Merge two streams of index tuples into new index files.
+ * itup is the first tuple that has been taken from the spool.
  */
 static void
-_bt_mergeload(Spooler *self, BTWriteState *wstate, BTSpool *btspool, BTReader *btspool2, Relation heapRel)
+_bt_mergeload(Spooler *self, BTWriteState *wstate, BTSpool *btspool,
+			  BTReader *btspool2, Relation heapRel,
+			  IndexTuple itup, bool should_free)
 {
 	BTPageState	   *state = NULL;
-	IndexTuple		itup,
-					itup2;
-	bool			should_free = false;
+	IndexTuple		itup2;
 	TupleDesc		tupdes = RelationGetDescr(wstate->index);
 	int				keysz = RelationGetNumberOfAttributes(wstate->index);
 	ScanKey			indexScanKey;
@@ -465,7 +735,6 @@ _bt_mergeload(Spooler *self, BTWriteState *wstate, BTSpool *btspool, BTReader *b
 	Assert(btspool != NULL);
 
 	/* the preparation of merge */
-	itup = BTSpoolGetNextItem(btspool, NULL, &should_free);
 	itup2 = BTReaderGetNextItem(btspool2);
 	indexScanKey = _bt_mkscankey_nodata(wstate->index);
 
@@ -653,6 +922,11 @@ BTSpoolGetNextItem(BTSpool *spool, IndexTuple itup, bool *should_free)
 {
 	if (*should_free)
 		pfree(itup);
+	if (((BTSortedSpool *) spool)->sorted)
+	{
+		*should_free = true;
+		return BTSpoolReadRun((BTSortedSpool *) spool);
+	}
 #if PG_VERSION_NUM >= 100000
 	return tuplesort_getindextuple(spool->sortstate, true);
 #else
@@ -660,6 +934,281 @@ BTSpoolGetNextItem(BTSpool *spool, IndexTuple itup, bool *should_free)
 #endif
 }
 
+/*
+ * BTSpoolWrap - Replace a spool with a BTSortedSpool.
+ */
+static BTSpool *
+BTSpoolWrap(BTSpool *spool, bool enforce)
+{
+	BTSortedSpool  *self;
+
+	self = palloc0(sizeof(BTSortedSpool));
+	memcpy(&self->spool, spool, sizeof(BTSpool));
+	pfree(spool);
+
+	self->sorted = true;
+	self->enforce = enforce;
+	self->tuples = NULL;
+	self->ntuples = 0;
+	self->maxtuples = 0;
+	self->current = 0;
+	self->availMem = maintenance_work_mem * 1024L;
+	self->run = NULL;
+	self->runlen = 0;
+	self->last = NULL;
+	self->lastlen = 0;
+	self->scankey = _bt_mkscankey_nodata(self->spool.index);
+	self->context = CurrentMemoryContext;
+
+	return &self->spool;
+}
+
+/*
+ * BTSpoolAdd - Add an index tuple to the spool.
+ *
+ * The tuple is appended to the run if it is not less than the last one.
+ * Equal keys are sent to the tuplesort if they must be unique, so that it
+ * reports the duplicate.
+ */
+static void
+BTSpoolAdd(BTSpool *spool, IndexTuple itup, Datum *values, bool *isnull)
+{
+	BTSortedSpool  *self = (BTSortedSpool *) spool;
+
+	if (self->sorted)
+	{
+		Size		len = IndexTupleSize(itup);
+		bool		hasnull = false;
+		int32		compare = -1;
+
+		if (self->last != NULL)
+			compare = compare_indextuple(self->last, itup, self->scankey,
+							RelationGetNumberOfAttributes(spool->index),
+							RelationGetDescr(spool->index), &hasnull);
+
+		if (compare < 0 || (compare == 0 && (!self->enforce || hasnull)))
+		{
+			if (self->run == NULL)
+			{
+				IndexTuple	copy;
+
+				if (self->ntuples >= self->maxtuples &&
+					self->maxtuples < MaxAllocSize / sizeof(IndexTuple) / 2)
+				{
+					self->maxtuples = Max(self->maxtuples * 2, 1024);
+					if (self->tuples == NULL)
+						self->tuples = MemoryContextAlloc(self->context,
+									self->maxtuples * sizeof(IndexTuple));
+					else
+						self->tuples = repalloc(self->tuples,
+									self->maxtuples * sizeof(IndexTuple));
+				}
+
+				copy = MemoryContextAlloc(self->context, len);
+				memcpy(copy, itup, len);
+				self->availMem -= GetMemoryChunkSpace(copy) + sizeof(IndexTuple);
+
+				if (self->ntuples < self->maxtuples && self->availMem >= 0)
+					self->tuples[self->ntuples++] = copy;
+				else
+				{
+					pfree(copy);
+					BTSpoolSpillRun(self);
+				}
+			}
+			if (self->run != NULL)
+				BTSpoolWriteRun(self, itup);
+
+			if (self->lastlen < len)
+			{
+				if (self->last != NULL)
+					pfree(self->last);
+				self->last = MemoryContextAlloc(self->context, len);
+				self->lastlen = len;
+			}
+			memcpy(self->last, itup, len);
+			return;
+		}
+
+		BTSpoolSortRun(self);
+	}
+
+#if PG_VERSION_NUM >= 90500
+	_bt_spool(spool, &itup->t_tid, values, isnull);
+#else
+	_bt_spool(itup, spool);
+#endif
+}
+
+/*
+ * BTSpoolPerformSort - Finish adding tuples to the spool.  Only rewinds the
+ * run on disk if all tuples came in key order.
+ */
+static void
+BTSpoolPerformSort(BTSpool *spool)
+{
+	BTSortedSpool  *self = (BTSortedSpool *) spool;
+
+	if (!self->sorted)
+		tuplesort_performsort(spool->sortstate);
+	else if (self->run != NULL && BufFileSeek(self->run, 0, 0L, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not rewind temporary file: %m")));
+}
+
+/*
+ * BTSpoolDestroy - Release the run and the spool.
+ */
+static void
+BTSpoolDestroy(BTSpool *spool)
+{
+	BTSortedSpool  *self = (BTSortedSpool *) spool;
+	int				i;
+
+	for (i = self->current; i < self->ntuples; i++)
+		pfree(self->tuples[i]);
+	if (self->tuples != NULL)
+		pfree(self->tuples);
+	if (self->run != NULL)
+		BufFileClose(self->run);
+	if (self->last != NULL)
+		pfree(self->last);
+	_bt_freeskey(self->scankey);
+	_bt_spooldestroy(spool);
+}
+
+/*
+ * BTSpoolSortRun - Move tuples in the run to the tuplesort because the key
+ * order is broken.
+ */
+static void
+BTSpoolSortRun(BTSortedSpool *self)
+{
+	BTSpool	   *spool = &self->spool;
+	IndexTuple	itup;
+
+	elog(DEBUG1, "pg_bulkload: sort \"%s\"",
+		RelationGetRelationName(spool->index));
+
+	if (self->run != NULL &&
+		BufFileSeek(self->run, 0, 0L, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not rewind temporary file: %m")));
+
+	while ((itup = BTSpoolReadRun(self)) != NULL)
+	{
+#if PG_VERSION_NUM >= 90500
+		Datum		values[INDEX_MAX_KEYS];
+		bool		isnull[INDEX_MAX_KEYS];
+
+		index_deform_tuple(itup, RelationGetDescr(spool->index),
+						   values, isnull);
+		_bt_spool(spool, &itup->t_tid, values, isnull);
+#else
+		_bt_spool(itup, spool);
+#endif
+		pfree(itup);
+	}
+
+	if (self->tuples != NULL)
+		pfree(self->tuples);
+	self->tuples = NULL;
+	self->ntuples = self->maxtuples = self->current = 0;
+	if (self->run != NULL)
+		BufFileClose(self->run);
+	self->run = NULL;
+
+	if (self->last != NULL)
+		pfree(self->last);
+	self->last = NULL;
+	self->lastlen = 0;
+	self->sorted = false;
+}
+
+/*
+ * BTSpoolSpillRun - Move the run in memory to a temporary file because it
+ * exceeds the memory.
+ */
+static void
+BTSpoolSpillRun(BTSortedSpool *self)
+{
+	MemoryContext	oldcxt;
+	int				i;
+
+	elog(DEBUG1, "pg_bulkload: write presorted run of \"%s\"",
+		RelationGetRelationName(self->spool.index));
+
+	oldcxt = MemoryContextSwitchTo(self->context);
+	self->run = BufFileCreateTemp(false);
+	MemoryContextSwitchTo(oldcxt);
+
+	for (i = 0; i < self->ntuples; i++)
+	{
+		BTSpoolWriteRun(self, self->tuples[i]);
+		pfree(self->tuples[i]);
+	}
+	if (self->tuples != NULL)
+		pfree(self->tuples);
+	self->tuples = NULL;
+	self->ntuples = self->maxtuples = 0;
+}
+
+/*
+ * BTSpoolWriteRun - Append a tuple to the run on disk.
+ */
+static void
+BTSpoolWriteRun(BTSortedSpool *self, IndexTuple itup)
+{
+	Size		len = IndexTupleSize(itup);
+
+	if (BufFileWrite(self->run, itup, len) != len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to temporary file: %m")));
+	self->runlen += len;
+}
+
+/*
+ * BTSpoolReadRun - Read the next tuple in the run, or NULL at the end.
+ * Tuples in memory are handed over to the caller, who frees them.
+ */
+static IndexTuple
+BTSpoolReadRun(BTSortedSpool *self)
+{
+	IndexTupleData	header;
+	IndexTuple		itup;
+	Size			len;
+	size_t			nread;
+
+	if (self->run == NULL)
+	{
+		if (self->current >= self->ntuples)
+			return NULL;
+		return self->tuples[self->current++];
+	}
+
+	nread = BufFileRead(self->run, &header, sizeof(header));
+	if (nread == 0)
+		return NULL;
+	if (nread != sizeof(header))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from temporary file: %m")));
+
+	len = IndexTupleSize(&header);
+	itup = palloc(len);
+	memcpy(itup, &header, sizeof(header));
+	if (BufFileRead(self->run, (char *) itup + sizeof(header),
+					len - sizeof(header)) != len - sizeof(header))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from temporary file: %m")));
+
+	return itup;
+}
+
 /**
  * @brief Read the left-most leaf page by walking down on index tree structure
  * from root node.
@@ -872,6 +1421,104 @@ BTReaderGetNextItem(BTReader *reader)
 	}
 }
 
+/**
+ * @brief Get a copy of the largest item in the old index
+ *
+ * Walks down to the right-most leaf page along the last downlinks, and goes
+ * left while the leaf has no live items.  The reader is rewound to the page
+ * that it was reading.
+ *
+ * @param reader [in/out] BTReader structure
+ * @return the largest index tuple, or null if no tuples
+ */
+static IndexTuple
+BTReaderGetLastItem(BTReader *reader)
+{
+	BlockNumber		blkno = reader->blkno;
+	BTMetaPageData *metad;
+	BTPageOpaque	opaque;
+	IndexTuple		itup = NULL;
+
+	BTReaderReadPage(reader, BTREE_METAPAGE);
+	metad = BTPageGetMeta(reader->page);
+	BTReaderReadPage(reader, metad->btm_fastroot);
+	opaque = (BTPageOpaque) PageGetSpecialPointer(reader->page);
+
+	/* The fast root and its right-most descendants have no high keys. */
+	while (!P_ISLEAF(opaque))
+	{
+		ItemId		lastid;
+
+		lastid = PageGetItemId(reader->page,
+							   PageGetMaxOffsetNumber(reader->page));
+		itup = (IndexTuple) PageGetItem(reader->page, lastid);
+		BTReaderReadPage(reader, ItemPointerGetBlockNumber(&(itup->t_tid)));
+		opaque = (BTPageOpaque) PageGetSpecialPointer(reader->page);
+	}
+
+	itup = NULL;
+	for (;;)
+	{
+		if (!P_IGNORE(opaque))
+		{
+			OffsetNumber	offnum;
+
+			for (offnum = PageGetMaxOffsetNumber(reader->page);
+				 offnum >= P_FIRSTDATAKEY(opaque);
+				 offnum = OffsetNumberPrev(offnum))
+			{
+				ItemId	itemid = PageGetItemId(reader->page, offnum);
+
+				if (!ItemIdIsDead(itemid))
+				{
+					itup = CopyIndexTuple(
+						(IndexTuple) PageGetItem(reader->page, itemid));
+					break;
+				}
+			}
+		}
+
+		if (itup != NULL || P_LEFTMOST(opaque))
+			break;
+
+		BTReaderReadPage(reader, opaque->btpo_prev);
+		opaque = (BTPageOpaque) PageGetSpecialPointer(reader->page);
+	}
+
+	BTReaderReadPage(reader, blkno);
+
+	return itup;
+}
+
+/**
+ * @brief Check whether itup and all following tuples in the spool sort after
+ * every item in the old index.  No tuple in the spool is regarded as true.
+ */
+static bool
+BTReaderIsBefore(BTReader *reader, Relation rel, IndexTuple itup)
+{
+	IndexTuple	last;
+	ScanKey		indexScanKey;
+	bool		hasnull;
+	bool		result;
+
+	if (itup == NULL)
+		return true;
+
+	last = BTReaderGetLastItem(reader);
+	if (last == NULL)
+		return true;
+
+	indexScanKey = _bt_mkscankey_nodata(rel);
+	result = compare_indextuple(itup, last, indexScanKey,
+								RelationGetNumberOfAttributes(rel),
+								RelationGetDescr(rel), &hasnull) > 0;
+	_bt_freeskey(indexScanKey);
+	pfree(last);
+
+	return result;
+}
+
 static int
 compare_indextuple(const IndexTuple itup1, const IndexTuple itup2,
 	ScanKey entry, int keysz, TupleDesc tupdes, bool *hasnull)
@@ -982,7 +1629,8 @@ remove_duplicate(Spooler *self, Relation heap, IndexTuple itup, const char *reln
 
 		/* output duplicate bad file. */
 		if (self->dup_fp == NULL)
-			if ((self->dup_fp = AllocateFile(self->dup_badfile, "w")) == NULL)
+			if ((self->dup_fp = AllocateFile(self->dup_badfile,
+											 self->dup_append ? "a" : "w")) == NULL)
 				ereport(ERROR,
 						(errcode_for_file_access(),
 						 errmsg("could not open duplicate bad file \"%s\": %m",
@@ -69,6 +69,9 @@ instr_time prof_merge_unique;
 instr_time prof_merge_insert;
 instr_time prof_merge_term;
 
+/* how each index was spooled; allocated in TopTransactionContext */
+List *prof_spools = NIL;
+
 instr_time *prof_top;
 
 static void
@@ -132,6 +135,17 @@ BULKLOAD_PROFILE_PRINT()
 	seconds[i++] = INSTR_TIME_GET_DOUBLE(prof_merge_insert);
 	seconds[i++] = INSTR_TIME_GET_DOUBLE(prof_merge_term);
 	print_profiles("MERGE", i, MERGEs, seconds);
+
+	/* SPOOL */
+	if (prof_spools != NIL)
+	{
+		ListCell   *cell;
+
+		elog(INFO, "<SPOOL>");
+		foreach (cell, prof_spools)
+			elog(INFO, "  %s", (char *) lfirst(cell));
+		prof_spools = NIL;
+	}
 }
 #else
 #define BULKLOAD_PROFILE_PRINT()	((void) 0)
@@ -158,6 +172,7 @@ pg_bulkload(PG_FUNCTION_ARGS)
 	Datum			options;
 	MemoryContext	ctx;
 	MemoryContext	ccxt;
+	HeapTuple	   *tuples;
 	PGRUsage		ru0;
 	PGRUsage		ru1;
 	int64			count;
@@ -179,6 +194,9 @@ pg_bulkload(PG_FUNCTION_ARGS)
 		elog(ERROR, "return type must be a row type");
 
 	BULKLOAD_PROFILE_PUSH();
+#ifdef ENABLE_BULKLOAD_PROFILE
+	prof_spools = NIL;
+#endif
 
 	pg_rusage_init(&ru0);
 
@@ -218,6 +236,8 @@ pg_bulkload(PG_FUNCTION_ARGS)
 
 		/* initialize checker */
 		CheckerInit(&rd->checker, wt->rel, wt->tchecker);
+		if (wt->reserve)
+			rd->checker.placer = wt;
 
 		/* initialize parser */
 		ParserInit(rd->parser, &rd->checker, rd->infile, wt->desc,
@@ -254,29 +274,32 @@ pg_bulkload(PG_FUNCTION_ARGS)
 		 * STEP 2: Build heap
 		 */
 
+		tuples = palloc(READER_BATCH_SIZE * sizeof(HeapTuple));
+
 		/* Switch into its memory context */
 		Assert(wt->context);
 		ctx = MemoryContextSwitchTo(wt->context);
 
-		/* Loop for each input file record. */
+		/* Loop for each batch of input file records. */
 		while (wt->count < rd->limit)
 		{
-			HeapTuple	tuple;
+			int		ntuples;
 
 			CHECK_FOR_INTERRUPTS();
 
-			/* read tuple */
+			/* read tuples */
 			BULKLOAD_PROFILE_PUSH();
-			tuple = ReaderNext(rd);
+			ntuples = ReaderNextBatch(rd, tuples,
+							(int) Min(READER_BATCH_SIZE, rd->limit - wt->count));
 			BULKLOAD_PROFILE_POP();
 			BULKLOAD_PROFILE(&prof_reader);
-			if (tuple == NULL)
+			if (ntuples == 0)
 				break;
 
-			/* write tuple */
+			/* write tuples */
 			BULKLOAD_PROFILE_PUSH();
-			WriterInsert(wt, tuple);
-			wt->count += 1;
+			WriterInsertBatch(wt, tuples, ntuples);
+			wt->count += ntuples;
 			BULKLOAD_PROFILE_POP();
 			BULKLOAD_PROFILE(&prof_writer);
 
@@ -374,7 +397,11 @@ VerifyTarget(Relation rel, int64 max_dup_errors)
 {
 	AclMode	required_access;
 	AclMode	aclresult;
-	if (rel->rd_rel->relkind != RELKIND_RELATION)
+	if (rel->rd_rel->relkind != RELKIND_RELATION
+#if PG_VERSION_NUM >= 100000
+		&& rel->rd_rel->relkind != RELKIND_PARTITIONED_TABLE
+#endif
+		)
 	{
 		const char *type;
 		switch (rel->rd_rel->relkind)
@@ -0,0 +1,352 @@
+/*
+ * pg_bulkload: lib/pg_compress.c
+ *
+ *	  Copyright (c) 2007-2016, NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ *	  Portions Copyright (c) 1996-2015, PostgreSQL Global Development Group
+ *	  Portions Copyright (c) 1994, Regents of the University of California
+ */
+
+/**
+ * @file
+ * @brief Thread-safe compression of toasted values
+ *
+ * Copied from pglz_compress() in PostgreSQL 9.5 and toast_compress_datum(),
+ * with the history table moved to a workspace given by the caller.  The
+ * output is the same as toast_compress_datum() with the default strategy,
+ * so it can be decompressed by any supported server.  It must not call any
+ * PostgreSQL functions because it runs in worker threads.
+ */
+#include "postgres.h"
+
+#include <limits.h>
+
+#include "pg_compress.h"
+
+/* PGLZ_strategy_default */
+#define PGLZ_MIN_INPUT_SIZE		32
+#define PGLZ_MIN_COMP_RATE		25
+#define PGLZ_FIRST_SUCCESS_BY	1024
+#define PGLZ_MATCH_SIZE_GOOD	128
+#define PGLZ_MATCH_SIZE_DROP	10
+
+#define PGLZ_MAX_MATCH			273
+
+#define INVALID_ENTRY			0
+
+/*
+ * Computes the history table slot for the lookup by the next 4 characters
+ * in the input.
+ */
+#define pglz_hist_idx(_s,_e, _mask) (										\
+			((((_e) - (_s)) < 4) ? (int) (_s)[0] :							\
+			 (((_s)[0] << 6) ^ ((_s)[1] << 4) ^								\
+			  ((_s)[2] << 2) ^ (_s)[3])) & (_mask)							\
+		)
+
+/*
+ * Adds a new entry to the history table.  If _recycle is true, then we are
+ * recycling a previously used entry, and must first delink it from its old
+ * hashcode's linked list.
+ */
+#define pglz_hist_add(_hs,_he,_hn,_recycle,_s,_e, _mask)	\
+do {									\
+			int __hindex = pglz_hist_idx((_s),(_e), (_mask));				\
+			int16 *__myhsp = &(_hs)[__hindex];								\
+			PGLZHistEntry *__myhe = &(_he)[_hn];							\
+			if (_recycle) {													\
+				if (__myhe->prev == NULL)									\
+					(_hs)[__myhe->hindex] = __myhe->next - (_he);			\
+				else														\
+					__myhe->prev->next = __myhe->next;						\
+				if (__myhe->next != NULL)									\
+					__myhe->next->prev = __myhe->prev;						\
+			}																\
+			__myhe->next = &(_he)[*__myhsp];								\
+			__myhe->prev = NULL;											\
+			__myhe->hindex = __hindex;										\
+			__myhe->pos  = (_s);											\
+			/* the 0th entry is unused, so we can scribble on it */			\
+			(_he)[(*__myhsp)].prev = __myhe;								\
+			*__myhsp = _hn;													\
+			if (++(_hn) >= PGLZ_HISTORY_SIZE + 1) {							\
+				(_hn) = 1;													\
+				(_recycle) = true;											\
+			}																\
+} while (0)
+
+/*
+ * Outputs the last and allocates a new control byte if needed.
+ */
+#define pglz_out_ctrl(__ctrlp,__ctrlb,__ctrl,__buf) \
+do { \
+	if ((__ctrl & 0xff) == 0)												\
+	{																		\
+		*(__ctrlp) = __ctrlb;												\
+		__ctrlp = (__buf)++;												\
+		__ctrlb = 0;														\
+		__ctrl = 1;															\
+	}																		\
+} while (0)
+
+/*
+ * Outputs a literal byte to the destination buffer including the
+ * appropriate control bit.
+ */
+#define pglz_out_literal(_ctrlp,_ctrlb,_ctrl,_buf,_byte) \
+do { \
+	pglz_out_ctrl(_ctrlp,_ctrlb,_ctrl,_buf);								\
+	*(_buf)++ = (unsigned char)(_byte);										\
+	_ctrl <<= 1;															\
+} while (0)
+
+/*
+ * Outputs a backward reference tag of 2-4 bytes (depending on offset and
+ * length) to the destination buffer including the appropriate control bit.
+ */
+#define pglz_out_tag(_ctrlp,_ctrlb,_ctrl,_buf,_len,_off) \
+do { \
+	pglz_out_ctrl(_ctrlp,_ctrlb,_ctrl,_buf);								\
+	_ctrlb |= _ctrl;														\
+	_ctrl <<= 1;															\
+	if (_len > 17)															\
+	{																		\
+		(_buf)[0] = (unsigned char)((((_off) & 0xf00) >> 4) | 0x0f);		\
+		(_buf)[1] = (unsigned char)(((_off) & 0xff));						\
+		(_buf)[2] = (unsigned char)((_len) - 18);							\
+		(_buf) += 3;														\
+	} else {																\
+		(_buf)[0] = (unsigned char)((((_off) & 0xf00) >> 4) | ((_len) - 3)); \
+		(_buf)[1] = (unsigned char)((_off) & 0xff);							\
+		(_buf) += 2;														\
+	}																		\
+} while (0)
+
+/*
+ * Lookup the history table if the actual input stream matches another
+ * sequence of characters, starting somewhere earlier in the input buffer.
+ */
+static inline int
+pglz_find_match(PGLZWorkspace *ws, const char *input, const char *end,
+				int *lenp, int *offp, int good_match, int good_drop, int mask)
+{
+	PGLZHistEntry *hent;
+	int16		hentno;
+	int32		len = 0;
+	int32		off = 0;
+
+	/*
+	 * Traverse the linked history list until a good enough match is found.
+	 */
+	hentno = ws->hist_start[pglz_hist_idx(input, end, mask)];
+	hent = &ws->hist_entries[hentno];
+	while (hent != &ws->hist_entries[INVALID_ENTRY])
+	{
+		const char *ip = input;
+		const char *hp = hent->pos;
+		int32		thisoff;
+		int32		thislen;
+
+		/* Stop if the offset does not fit into our tag anymore. */
+		thisoff = ip - hp;
+		if (thisoff >= 0x0fff)
+			break;
+
+		/*
+		 * Determine length of match.  A better match must be larger than the
+		 * best so far.  And if we already have a match of 16 or more bytes,
+		 * it's worth the call overhead to use memcmp() to check if this
+		 * match is equal for the same size.
+		 */
+		thislen = 0;
+		if (len >= 16)
+		{
+			if (memcmp(ip, hp, len) == 0)
+			{
+				thislen = len;
+				ip += len;
+				hp += len;
+				while (ip < end && *ip == *hp && thislen < PGLZ_MAX_MATCH)
+				{
+					thislen++;
+					ip++;
+					hp++;
+				}
+			}
+		}
+		else
+		{
+			while (ip < end && *ip == *hp && thislen < PGLZ_MAX_MATCH)
+			{
+				thislen++;
+				ip++;
+				hp++;
+			}
+		}
+
+		/* Remember this match as the best (if it is) */
+		if (thislen > len)
+		{
+			len = thislen;
+			off = thisoff;
+		}
+
+		/* Advance to the next history entry */
+		hent = hent->next;
+
+		/*
+		 * Be happy with lesser good matches the more entries we visited.  But
+		 * no point in doing calculation if we're at end of list.
+		 */
+		if (hent != &ws->hist_entries[INVALID_ENTRY])
+		{
+			if (len >= good_match)
+				break;
+			good_match -= (good_match * good_drop) / 100;
+		}
+	}
+
+	/* Return match information only if it results at least in one byte
+	 * reduction. */
+	if (len > 2)
+	{
+		*lenp = len;
+		*offp = off;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Compresses source into dest with the default strategy.  Returns the number
+ * of bytes written in dest, or -1 if compression fails.
+ */
+static int32
+pglz_compress_ws(const char *source, int32 slen, char *dest,
+				 PGLZWorkspace *ws)
+{
+	unsigned char *bp = (unsigned char *) dest;
+	unsigned char *bstart = bp;
+	int			hist_next = 1;
+	bool		hist_recycle = false;
+	const char *dp = source;
+	const char *dend = source + slen;
+	unsigned char ctrl_dummy = 0;
+	unsigned char *ctrlp = &ctrl_dummy;
+	unsigned char ctrlb = 0;
+	unsigned char ctrl = 0;
+	bool		found_match = false;
+	int32		match_len;
+	int32		match_off;
+	int32		result_size;
+	int32		result_max;
+	int			hashsz;
+	int			mask;
+
+	if (slen < PGLZ_MIN_INPUT_SIZE)
+		return -1;
+
+	/*
+	 * Compute the maximum result size allowed by the strategy, namely the
+	 * input size minus the minimum wanted compression rate.
+	 */
+	if (slen > (INT_MAX / 100))
+		result_max = (slen / 100) * (100 - PGLZ_MIN_COMP_RATE);
+	else
+		result_max = (slen * (100 - PGLZ_MIN_COMP_RATE)) / 100;
+
+	/*
+	 * Experiments suggest that these hash sizes work pretty well.  A large
+	 * hash table minimizes collision, but has a higher startup cost.
+	 */
+	if (slen < 128)
+		hashsz = 512;
+	else if (slen < 256)
+		hashsz = 1024;
+	else if (slen < 512)
+		hashsz = 2048;
+	else if (slen < 1024)
+		hashsz = 4096;
+	else
+		hashsz = 8192;
+	mask = hashsz - 1;
+
+	/* Initialize the history lists to empty. */
+	memset(ws->hist_start, 0, hashsz * sizeof(int16));
+
+	/* Compress the source directly into the output buffer. */
+	while (dp < dend)
+	{
+		/* Give up if the output exceeds the maximum result size. */
+		if (bp - bstart >= result_max)
+			return -1;
+
+		/* Give up if no match is found in the first bytes. */
+		if (!found_match && bp - bstart >= PGLZ_FIRST_SUCCESS_BY)
+			return -1;
+
+		if (pglz_find_match(ws, dp, dend, &match_len, &match_off,
+							PGLZ_MATCH_SIZE_GOOD, PGLZ_MATCH_SIZE_DROP, mask))
+		{
+			/*
+			 * Create the tag and add history entries for all matched
+			 * characters.
+			 */
+			pglz_out_tag(ctrlp, ctrlb, ctrl, bp, match_len, match_off);
+			while (match_len--)
+			{
+				pglz_hist_add(ws->hist_start, ws->hist_entries,
+							  hist_next, hist_recycle,
+							  dp, dend, mask);
+				dp++;
+			}
+			found_match = true;
+		}
+		else
+		{
+			/* No match found. Copy one literal byte. */
+			pglz_out_literal(ctrlp, ctrlb, ctrl, bp, *dp);
+			pglz_hist_add(ws->hist_start, ws->hist_entries,
+						  hist_next, hist_recycle,
+						  dp, dend, mask);
+			dp++;
+		}
+	}
+
+	/* Write out the last control byte and check that we haven't overrun the
+	 * output size allowed by the strategy. */
+	*ctrlp = ctrlb;
+	result_size = bp - bstart;
+	if (result_size >= result_max)
+		return -1;
+
+	return result_size;
+}
+
+/**
+ * @brief Compress a raw value into a compressed inline datum.
+ *
+ * @param source [in] Data of the value without varlena header.
+ * @param slen [in] Size of the data.
+ * @param dest [out] Buffer of COMPRESS_BUFSIZE(slen) bytes.
+ * @param ws [in] Workspace owned by the calling thread.
+ * @return true if compressed, or false if the value is incompressible.
+ */
+bool
+CompressValue(const char *source, int32 slen, struct varlena *dest,
+			  PGLZWorkspace *ws)
+{
+	int32	len;
+
+	len = pglz_compress_ws(source, slen, (char *) dest + COMPRESS_HDRSZ, ws);
+
+	/* Same as toast_compress_datum; we need at least 2 bytes saved. */
+	if (len >= 0 && len + COMPRESS_HDRSZ < slen - 2)
+	{
+		((varattrib_4b *) dest)->va_compressed.va_rawsize = slen;
+		SET_VARSIZE_COMPRESSED(dest, len + COMPRESS_HDRSZ);
+		return true;
+	}
+
+	return false;
+}
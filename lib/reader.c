@@ -10,9 +10,13 @@
  */
 #include "pg_bulkload.h"
 
+#include <ctype.h>
 #include <fcntl.h>
+#include <float.h>
+#include <limits.h>
 #include <string.h>
 
+#include "access/hash.h"
 #include "access/heapam.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_language.h"
@@ -22,12 +26,17 @@
 #include "nodes/parsenodes.h"
 #include "parser/parse_coerce.h"
 #include "pgstat.h"
+#include "pgtime.h"
 #include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/resowner.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #include "utils/typcache.h"
 
 #include "logger.h"
@@ -35,6 +44,7 @@
 #include "pg_strutil.h"
 #include "pgut/pgut-be.h"
 #include "reader.h"
+#include "writer.h"
 
 #include "storage/fd.h"
 
@@ -221,30 +231,82 @@ ReaderClose(Reader *rd, bool onError)
 HeapTuple
 ReaderNext(Reader *rd)
 {
-	HeapTuple		tuple;
+	HeapTuple	tuple;
+
+	if (ReaderNextBatch(rd, &tuple, 1) == 0)
+		return NULL;
+
+	return tuple;
+}
+
+/*
+ * Read tuples with the generic loop for parsers without readBatch.
+ */
+static bool
+ParserReadBatchDefault(Parser *parser, Checker *checker,
+					   HeapTuple *tuples, int *ntuples, int maxtuples)
+{
+	while (*ntuples < maxtuples)
+	{
+		HeapTuple	read;
+		HeapTuple	tuple;
+
+		parser->parsing_field = -1;
+		read = ParserRead(parser, checker);
+		if (read == NULL)
+			return false;
+
+		tuple = CheckerRecord(checker, read, &parser->parsing_field);
+		if (checker->placer)
+			WriterConfirm(checker->placer, tuple);
+
+		/* keep the tuple that the next read overwrites unless coerced */
+		if (parser->reuse_tuple && tuple == read)
+			tuple = heap_copytuple(tuple);
+		tuples[(*ntuples)++] = tuple;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Read up to maxtuples tuples from parser.
+ *
+ * Parse errors are absorbed in the same way as ReaderNext, but the error
+ * handler is set up once for each run of good records rather than for each
+ * record.  Tuples are allocated in the current memory context, which must
+ * not be reset until the tuples are written.
+ *
+ * @param rd  [in/out] reader
+ * @param tuples  [out] array of read tuples
+ * @param maxtuples  [in] size of tuples
+ * @return number of tuples read, or 0 at the end of input
+ */
+int
+ReaderNextBatch(Reader *rd, HeapTuple *tuples, int maxtuples)
+{
 	MemoryContext	ccxt;
-	bool			eof;
 	Parser		   *parser = rd->parser;
 
 	ccxt = CurrentMemoryContext;
 
-	eof = false;
-	do
+	rd->ntuples = 0;
+	while (!rd->eof && rd->ntuples < maxtuples)
 	{
-		tuple = NULL;
 		parser->parsing_field = -1;
 
 		PG_TRY();
 		{
-			tuple = ParserRead(parser, &rd->checker);
-			if (tuple == NULL)
-				eof = true;
+			bool	more;
+
+			if (parser->readBatch)
+				more = parser->readBatch(parser, &rd->checker, tuples,
+										 &rd->ntuples, maxtuples);
 			else
-			{
-				tuple = CheckerTuple(&rd->checker, tuple,
-									 &parser->parsing_field);
-				CheckerConstraints(&rd->checker, tuple, &parser->parsing_field);
-			}
+				more = ParserReadBatchDefault(parser, &rd->checker, tuples,
+											  &rd->ntuples, maxtuples);
+			if (!more)
+				rd->eof = true;
 		}
 		PG_CATCH();
 		{
@@ -269,6 +331,10 @@ ReaderNext(Reader *rd)
 					break;
 			}
 
+			/* Release the space reserved for the rejected record. */
+			if (rd->checker.placer)
+				WriterCancel(rd->checker.placer);
+
 			/* Absorb parse errors. */
 			rd->parse_errors++;
 			if (errdata->message)
@@ -293,7 +359,7 @@ ReaderNext(Reader *rd)
 			/* Terminate if PARSE_ERRORS has been reached. */
 			if (rd->parse_errors > rd->max_parse_errors)
 			{
-				eof = true;
+				rd->eof = true;
 				LoggerLog(WARNING,
 					"Maximum parse error count exceeded - " int64_FMT
 					" error(s) found in input file\n",
@@ -310,16 +376,15 @@ ReaderNext(Reader *rd)
 
 			ParserDumpRecord(parser, rd->parse_fp, rd->parse_badfile);
 
-			MemoryContextReset(ccxt);
-			// Without the below line, the regression tests shows the different result on debug-build mode.
-			tuple = NULL;
+			/* tuples read before the error are still in the context */
+			if (rd->ntuples == 0)
+				MemoryContextReset(ccxt);
 		}
 		PG_END_TRY();
-
-	} while (!eof && !tuple);
+	}
 
 	BULKLOAD_PROFILE(&prof_reader_parser);
-	return tuple;
+	return rd->ntuples;
 }
 
 void
@@ -567,6 +632,795 @@ CheckerConstraints(Checker *checker, HeapTuple tuple, int *parsing_field)
 	return tuple;
 }
 
+/*
+ * Check a tuple read from the parser.
+ */
+HeapTuple
+CheckerRecord(Checker *checker, HeapTuple tuple, int *parsing_field)
+{
+	tuple = CheckerTuple(checker, tuple, parsing_field);
+	CheckerConstraints(checker, tuple, parsing_field);
+
+	return tuple;
+}
+
+/*
+ * Fast input converters.
+ *
+ * Converters for common scalar types parse the plain forms of the values by
+ * themselves, and fall back to the type input function for anything else, ex.
+ * white spaces, exponents, special values, typmods or invalid input.  So the
+ * results and the errors are the same as the input functions.
+ */
+
+/* Call the type input function. */
+static Datum
+InputByFunction(TupleFormer *former, const char *str, int col)
+{
+	return FunctionCall3(&former->typInput[col],
+		CStringGetDatum(str),
+		ObjectIdGetDatum(former->typIOParam[col]),
+		Int32GetDatum(former->typMod[col]));
+}
+
+/*
+ * Parse [+-]?[0-9]+ with at most maxdigits digits.
+ */
+static bool
+ParsePlainInteger(const char *str, int maxdigits, int64 *result)
+{
+	const char *p = str;
+	bool		neg = false;
+	int64		value = 0;
+	int			ndigits;
+
+	if (*p == '-')
+	{
+		neg = true;
+		p++;
+	}
+	else if (*p == '+')
+		p++;
+
+	for (ndigits = 0; *p >= '0' && *p <= '9'; p++, ndigits++)
+	{
+		if (ndigits >= maxdigits)
+			return false;
+		value = value * 10 + (*p - '0');
+	}
+
+	if (ndigits == 0 || *p != '\0')
+		return false;
+
+	*result = (neg ? -value : value);
+	return true;
+}
+
+/*
+ * Parse [+-]?[0-9]+(\.[0-9]+)? with at most maxdigits digits and maxscale
+ * digits after the decimal point.  The value is mantissa / 10^scale.
+ */
+static bool
+ParsePlainDecimal(const char *str, int maxdigits, int maxscale,
+				  int64 *mantissa, int *scale, bool *neg)
+{
+	const char *p = str;
+	int64		value = 0;
+	int			ndigits = 0;
+	int			nscale = 0;
+
+	*neg = false;
+	if (*p == '-')
+	{
+		*neg = true;
+		p++;
+	}
+	else if (*p == '+')
+		p++;
+
+	for (; *p >= '0' && *p <= '9'; p++, ndigits++)
+	{
+		if (ndigits >= maxdigits)
+			return false;
+		value = value * 10 + (*p - '0');
+	}
+	if (ndigits == 0)
+		return false;
+
+	if (*p == '.')
+	{
+		for (p++; *p >= '0' && *p <= '9'; p++, ndigits++, nscale++)
+		{
+			if (ndigits >= maxdigits || nscale >= maxscale)
+				return false;
+			value = value * 10 + (*p - '0');
+		}
+		if (nscale == 0)
+			return false;
+	}
+
+	if (*p != '\0')
+		return false;
+
+	*mantissa = value;
+	*scale = nscale;
+	return true;
+}
+
+static Datum
+InputInt2(TupleFormer *former, const char *str, int col)
+{
+	int64	value;
+
+	if (ParsePlainInteger(str, 5, &value) &&
+		value >= SHRT_MIN && value <= SHRT_MAX)
+		return Int16GetDatum((int16) value);
+
+	return InputByFunction(former, str, col);
+}
+
+static Datum
+InputInt4(TupleFormer *former, const char *str, int col)
+{
+	int64	value;
+
+	if (ParsePlainInteger(str, 10, &value) &&
+		value >= INT_MIN && value <= INT_MAX)
+		return Int32GetDatum((int32) value);
+
+	return InputByFunction(former, str, col);
+}
+
+static Datum
+InputInt8(TupleFormer *former, const char *str, int col)
+{
+	int64	value;
+
+	/* 18 digits never overflow */
+	if (ParsePlainInteger(str, 18, &value))
+		return Int64GetDatum(value);
+
+	return InputByFunction(former, str, col);
+}
+
+/*
+ * A mantissa below 2^53 and a power of ten up to 10^22 are both exact in
+ * double, so one division gives the correctly rounded result, the same as
+ * strtod().  It holds only if double arithmetic is not done in extended
+ * precision.
+ */
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define USE_FAST_FLOAT_INPUT
+#endif
+
+#ifdef USE_FAST_FLOAT_INPUT
+static const double PowersOf10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static Datum
+InputFloat4(TupleFormer *former, const char *str, int col)
+{
+	int64	mantissa;
+	int		scale;
+	bool	neg;
+
+#if PG_VERSION_NUM >= 120000
+	/*
+	 * float4in uses strtof().  Below 2^24 and up to 10^10 are exact in float.
+	 */
+	if (ParsePlainDecimal(str, 7, 10, &mantissa, &scale, &neg))
+	{
+		float4	value = (float4) mantissa / (float4) PowersOf10[scale];
+
+		return Float4GetDatum(neg ? -value : value);
+	}
+#else
+	/* float4in rounds the result of strtod() to float4 */
+	if (ParsePlainDecimal(str, 15, 22, &mantissa, &scale, &neg))
+	{
+		float8	value = (float8) mantissa / PowersOf10[scale];
+
+		return Float4GetDatum((float4) (neg ? -value : value));
+	}
+#endif
+
+	return InputByFunction(former, str, col);
+}
+
+static Datum
+InputFloat8(TupleFormer *former, const char *str, int col)
+{
+	int64	mantissa;
+	int		scale;
+	bool	neg;
+
+	if (ParsePlainDecimal(str, 15, 22, &mantissa, &scale, &neg))
+	{
+		float8	value = (float8) mantissa / PowersOf10[scale];
+
+		return Float8GetDatum(neg ? -value : value);
+	}
+
+	return InputByFunction(former, str, col);
+}
+#endif   /* USE_FAST_FLOAT_INPUT */
+
+static Datum
+InputBool(TupleFormer *former, const char *str, int col)
+{
+	if ((str[0] == 't' || str[0] == '1') && str[1] == '\0')
+		return BoolGetDatum(true);
+	if ((str[0] == 'f' || str[0] == '0') && str[1] == '\0')
+		return BoolGetDatum(false);
+
+	return InputByFunction(former, str, col);
+}
+
+static Datum
+InputNumeric(TupleFormer *former, const char *str, int col)
+{
+	int64	value;
+
+	/*
+	 * Plain integers without typmod have the same representation as
+	 * numeric_in() gives, because both are normalized by make_result().
+	 */
+	if (former->typMod[col] < 0 && ParsePlainInteger(str, 18, &value))
+		return DirectFunctionCall1(int8_numeric, Int64GetDatum(value));
+
+	return InputByFunction(former, str, col);
+}
+
+static Datum
+InputText(TupleFormer *former, const char *str, int col)
+{
+	/* same as textin() */
+	return PointerGetDatum(cstring_to_text(str));
+}
+
+/*
+ * Compiled date/time formats.
+ *
+ * DATETIME_FORMAT = column:format declares the format of a date, timestamp
+ * or timestamptz column.  The format is compiled once into an array of nodes
+ * and the values are parsed by walking the nodes.  Unlike the other
+ * converters, values that do not match the format are errors; they are not
+ * passed to the type input function because it would interpret them in a
+ * different way, ex. by DateStyle.  Only integer timestamps are supported.
+ */
+#if PG_VERSION_NUM >= 100000 || defined(HAVE_INT64_TIMESTAMP)
+#define USE_DATETIME_FORMAT
+#endif
+
+#ifdef USE_DATETIME_FORMAT
+typedef enum DateTimeNodeType
+{
+	DTN_LITERAL,	/* the character itself */
+	DTN_YEAR,		/* YYYY */
+	DTN_MONTH,		/* MM */
+	DTN_DAY,		/* DD */
+	DTN_HOUR,		/* HH24 */
+	DTN_MINUTE,		/* MI */
+	DTN_SECOND,		/* SS */
+	DTN_MSEC,		/* MS */
+	DTN_USEC,		/* US */
+	DTN_EPOCH		/* EPOCH */
+} DateTimeNodeType;
+
+#define NUM_DATETIME_NODE_TYPES		(DTN_EPOCH + 1)
+
+typedef struct DateTimeNode
+{
+	DateTimeNodeType	type;
+	char				literal;	/* for DTN_LITERAL */
+} DateTimeNode;
+
+struct DateTimeFormat
+{
+	char		   *format;		/**< source of the format for messages */
+	int				nnodes;		/**< number of nodes */
+	DateTimeNode	nodes[1];	/**< VARIABLE LENGTH ARRAY */
+};
+
+static const struct
+{
+	const char		   *name;
+	DateTimeNodeType	type;
+} DateTimeKeywords[] =
+{
+	{ "YYYY", DTN_YEAR },
+	{ "HH24", DTN_HOUR },
+	{ "EPOCH", DTN_EPOCH },
+	{ "MM", DTN_MONTH },
+	{ "DD", DTN_DAY },
+	{ "MI", DTN_MINUTE },
+	{ "SS", DTN_SECOND },
+	{ "MS", DTN_MSEC },
+	{ "US", DTN_USEC }
+};
+
+/* Microseconds per unit of the last digit for each timestamp precision. */
+static const int64 TimestampScales[MAX_TIMESTAMP_PRECISION + 1] =
+{
+	INT64CONST(1000000),
+	INT64CONST(100000),
+	INT64CONST(10000),
+	INT64CONST(1000),
+	INT64CONST(100),
+	INT64CONST(10),
+	INT64CONST(1)
+};
+
+/* Seconds between the Unix epoch and the PostgreSQL epoch */
+#define EPOCH_DIFF_SECS \
+	((int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY)
+
+/* Epoch values must be shorter than 10^12 seconds (about 31,700 years). */
+#define MAX_EPOCH_SECS		INT64CONST(1000000000000)
+
+static void
+DateTimeFormatError(const char *format, const char *detail)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid DATETIME_FORMAT \"%s\"", format),
+			 errdetail("%s", detail)));
+}
+
+static DateTimeFormat *
+CompileDateTimeFormat(const char *format)
+{
+	DateTimeFormat *fmt;
+	const char	   *p = format;
+	bool			seen[NUM_DATETIME_NODE_TYPES];
+	int				i;
+
+	/* every node consumes at least one character */
+	fmt = palloc(offsetof(DateTimeFormat, nodes) +
+				 Max(strlen(format), 1) * sizeof(DateTimeNode));
+	fmt->format = pstrdup(format);
+	fmt->nnodes = 0;
+	memset(seen, 0, sizeof(seen));
+
+	while (*p)
+	{
+		/* "text" is literal text */
+		if (*p == '"')
+		{
+			for (p++; *p && *p != '"'; p++)
+			{
+				fmt->nodes[fmt->nnodes].type = DTN_LITERAL;
+				fmt->nodes[fmt->nnodes].literal = *p;
+				fmt->nnodes++;
+			}
+			if (*p == '\0')
+				DateTimeFormatError(format, "Unterminated quoted string.");
+			p++;
+			continue;
+		}
+
+		for (i = 0; i < lengthof(DateTimeKeywords); i++)
+		{
+			if (pg_strncasecmp(p, DateTimeKeywords[i].name,
+							   strlen(DateTimeKeywords[i].name)) == 0)
+				break;
+		}
+
+		if (i < lengthof(DateTimeKeywords))
+		{
+			DateTimeNodeType	type = DateTimeKeywords[i].type;
+
+			if (seen[type])
+				DateTimeFormatError(format, "A field appears twice.");
+			seen[type] = true;
+			fmt->nodes[fmt->nnodes].type = type;
+			fmt->nnodes++;
+			p += strlen(DateTimeKeywords[i].name);
+		}
+		else
+		{
+			fmt->nodes[fmt->nnodes].type = DTN_LITERAL;
+			fmt->nodes[fmt->nnodes].literal = *p;
+			fmt->nnodes++;
+			p++;
+		}
+	}
+
+	if (seen[DTN_EPOCH])
+	{
+		if (fmt->nnodes != 1)
+			DateTimeFormatError(format,
+				"EPOCH cannot be combined with other fields.");
+	}
+	else if (!seen[DTN_YEAR] || !seen[DTN_MONTH] || !seen[DTN_DAY])
+		DateTimeFormatError(format, "YYYY, MM and DD, or EPOCH are required.");
+
+	if (seen[DTN_MSEC] && seen[DTN_USEC])
+		DateTimeFormatError(format, "MS and US cannot be used together.");
+
+	return fmt;
+}
+
+/*
+ * Parse exactly ndigits digits.
+ */
+static bool
+ParseFixedDigits(const char **str, int ndigits, int *result)
+{
+	const char *p = *str;
+	int			value = 0;
+	int			i;
+
+	for (i = 0; i < ndigits; i++, p++)
+	{
+		if (*p < '0' || *p > '9')
+			return false;
+		value = value * 10 + (*p - '0');
+	}
+
+	*str = p;
+	*result = value;
+	return true;
+}
+
+/* Same as AdjustTimestampForTypmod() with integer timestamps */
+static void
+AdjustTimestampPrecision(Timestamp *time, int32 typmod)
+{
+	int64	scale;
+	int64	offset;
+
+	if (typmod < 0 || typmod >= MAX_TIMESTAMP_PRECISION)
+		return;
+
+	scale = TimestampScales[typmod];
+	offset = scale / 2;
+	if (*time >= 0)
+		*time = ((*time + offset) / scale) * scale;
+	else
+		*time = -((((-*time) + offset) / scale) * scale);
+}
+
+static void
+DateTimeMismatch(TupleFormer *former, const char *str, int col)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_DATETIME_FORMAT),
+			 errmsg("invalid input syntax for type %s: \"%s\"",
+					format_type_be(former->typId[col]), str),
+			 errdetail("Value does not match DATETIME_FORMAT \"%s\".",
+					   former->typFormat[col]->format)));
+}
+
+static Datum
+InputEpoch(TupleFormer *former, const char *str, int col)
+{
+	int64		mantissa;
+	int			scale;
+	bool		neg;
+	int64		time;
+
+	if (!ParsePlainDecimal(str, 18, 6, &mantissa, &scale, &neg))
+		DateTimeMismatch(former, str, col);
+
+	if (mantissa / TimestampScales[MAX_TIMESTAMP_PRECISION - scale] >=
+		MAX_EPOCH_SECS)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range: \"%s\"", str)));
+
+	/* microseconds since the PostgreSQL epoch */
+	time = mantissa * TimestampScales[scale];
+	if (neg)
+		time = -time;
+	time -= EPOCH_DIFF_SECS * USECS_PER_SEC;
+
+	if (former->typId[col] == DATEOID)
+	{
+		DateADT		date;
+
+		/* same as timestamp_date() */
+		date = time / USECS_PER_DAY;
+		if (time % USECS_PER_DAY < 0)
+			date--;
+		if (date < -POSTGRES_EPOCH_JDATE)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+					 errmsg("date out of range: \"%s\"", str)));
+		return DateADTGetDatum(date);
+	}
+
+	/* Julian day 0 is the lowest timestamp */
+	if (time < -(int64) POSTGRES_EPOCH_JDATE * USECS_PER_DAY)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range: \"%s\"", str)));
+
+	/* timestamp without time zone gets the time in UTC */
+	AdjustTimestampPrecision(&time, former->typMod[col]);
+	return TimestampGetDatum(time);
+}
+
+static Datum
+InputDateTime(TupleFormer *former, const char *str, int col)
+{
+	DateTimeFormat *fmt = former->typFormat[col];
+	const char	   *p = str;
+	struct pg_tm	tt,
+				   *tm = &tt;
+	int				usec = 0;
+	int				msec;
+	int				i;
+	Timestamp		result;
+
+	if (fmt->nodes[0].type == DTN_EPOCH)
+		return InputEpoch(former, str, col);
+
+	memset(tm, 0, sizeof(*tm));
+
+	for (i = 0; i < fmt->nnodes; i++)
+	{
+		bool	ok;
+
+		switch (fmt->nodes[i].type)
+		{
+			case DTN_YEAR:
+				ok = ParseFixedDigits(&p, 4, &tm->tm_year);
+				break;
+			case DTN_MONTH:
+				ok = ParseFixedDigits(&p, 2, &tm->tm_mon);
+				break;
+			case DTN_DAY:
+				ok = ParseFixedDigits(&p, 2, &tm->tm_mday);
+				break;
+			case DTN_HOUR:
+				ok = ParseFixedDigits(&p, 2, &tm->tm_hour);
+				break;
+			case DTN_MINUTE:
+				ok = ParseFixedDigits(&p, 2, &tm->tm_min);
+				break;
+			case DTN_SECOND:
+				ok = ParseFixedDigits(&p, 2, &tm->tm_sec);
+				break;
+			case DTN_MSEC:
+				ok = ParseFixedDigits(&p, 3, &msec);
+				usec = msec * 1000;
+				break;
+			case DTN_USEC:
+			{
+				/* 1 to 6 digits of fraction */
+				int		ndigits;
+
+				for (ndigits = 0; ndigits < 6 && *p >= '0' && *p <= '9';
+					 ndigits++, p++)
+					usec = usec * 10 + (*p - '0');
+				ok = (ndigits > 0);
+				for (; ndigits < 6; ndigits++)
+					usec *= 10;
+				break;
+			}
+			default:
+				ok = (*p == fmt->nodes[i].literal);
+				if (ok)
+					p++;
+				break;
+		}
+
+		if (!ok)
+			DateTimeMismatch(former, str, col);
+	}
+
+	if (*p != '\0')
+		DateTimeMismatch(former, str, col);
+
+	if (tm->tm_year < 1 ||
+		tm->tm_mon < 1 || tm->tm_mon > 12 || tm->tm_mday < 1 ||
+		tm->tm_mday > day_tab[isleap(tm->tm_year)][tm->tm_mon - 1] ||
+		tm->tm_hour > 23 || tm->tm_min > 59 || tm->tm_sec > 59)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_FIELD_OVERFLOW),
+				 errmsg("date/time field value out of range: \"%s\"", str)));
+
+	switch (former->typId[col])
+	{
+		case DATEOID:
+			return DateADTGetDatum(date2j(tm->tm_year, tm->tm_mon,
+										  tm->tm_mday) - POSTGRES_EPOCH_JDATE);
+		case TIMESTAMPOID:
+			if (tm2timestamp(tm, usec, NULL, &result) != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						 errmsg("timestamp out of range: \"%s\"", str)));
+			break;
+		default:
+		{
+			/* interpret the time in the session time zone */
+			int		tz;
+
+#if PG_VERSION_NUM >= 90200
+			tz = DetermineTimeZoneOffset(tm, session_timezone);
+#else
+			tz = DetermineTimeZoneOffset(tm, global_timezone);
+#endif
+			if (tm2timestamp(tm, usec, &tz, &result) != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						 errmsg("timestamp out of range: \"%s\"", str)));
+			break;
+		}
+	}
+
+	AdjustTimestampPrecision(&result, former->typMod[col]);
+	return TimestampGetDatum(result);
+}
+#endif   /* USE_DATETIME_FORMAT */
+
+/*
+ * Value cache.
+ *
+ * Columns with a few distinct values, ex. enums and domains, convert the
+ * same strings again and again, and their input functions are expensive
+ * because of syscache lookups or constraint checks.  The cache maps field
+ * strings to converted datums.  It has a fixed number of entries, and is
+ * disabled when the hit ratio in a window of lookups is poor.  Keys and
+ * datums are copied into a context which lives as long as the former,
+ * because the caller resets its per-tuple context after each row.
+ */
+#define VALUE_CACHE_SIZE		256		/* must be a power of 2 */
+#define VALUE_CACHE_MAX_ENTRIES	(VALUE_CACHE_SIZE * 3 / 4)
+#define VALUE_CACHE_MAX_KEY		64		/* longer strings are not cached */
+#define VALUE_CACHE_WINDOW		4096	/* lookups to check the hit ratio */
+#define VALUE_CACHE_MIN_HITS	(VALUE_CACHE_WINDOW / 2)
+
+typedef struct ValueCacheEntry
+{
+	char	   *key;		/* field string, or NULL if unused */
+	int			len;		/* length of key */
+	uint32		hash;		/* hash of key */
+	Datum		value;		/* converted datum */
+} ValueCacheEntry;
+
+struct ValueCache
+{
+	TupleFormerInputProc input;	/**< converter for misses */
+	bool		typbyval;		/**< type information to copy datums */
+	int16		typlen;
+	int			nentries;		/**< number of used entries */
+	int			lookups;		/**< lookups in the current window */
+	int			hits;			/**< hits in the current window */
+	ValueCacheEntry	entries[VALUE_CACHE_SIZE];
+};
+
+static Datum
+InputCached(TupleFormer *former, const char *str, int col)
+{
+	ValueCache	   *cache = former->typCache[col];
+	ValueCacheEntry *entry = NULL;
+	int				len = strlen(str);
+	uint32			hash = 0;
+	Datum			value;
+
+	if (len <= VALUE_CACHE_MAX_KEY)
+	{
+		int		i;
+
+		hash = DatumGetUInt32(hash_any((const unsigned char *) str, len));
+		for (i = hash & (VALUE_CACHE_SIZE - 1);
+			 cache->entries[i].key != NULL;
+			 i = (i + 1) & (VALUE_CACHE_SIZE - 1))
+		{
+			if (cache->entries[i].hash == hash &&
+				cache->entries[i].len == len &&
+				memcmp(cache->entries[i].key, str, len) == 0)
+			{
+				cache->hits++;
+				value = cache->entries[i].value;
+				goto done;
+			}
+		}
+		entry = &cache->entries[i];
+	}
+
+	value = cache->input(former, str, col);
+
+	/* remember the value unless the cache is full */
+	if (entry != NULL && cache->nentries < VALUE_CACHE_MAX_ENTRIES)
+	{
+		MemoryContext	oldcxt;
+
+		oldcxt = MemoryContextSwitchTo(former->cacheContext);
+		entry->key = palloc(len + 1);
+		memcpy(entry->key, str, len + 1);
+		entry->value = datumCopy(value, cache->typbyval, cache->typlen);
+		MemoryContextSwitchTo(oldcxt);
+
+		entry->len = len;
+		entry->hash = hash;
+		cache->nentries++;
+	}
+
+done:
+	if (++cache->lookups >= VALUE_CACHE_WINDOW)
+	{
+		/* give up caching if most of the lookups missed */
+		if (cache->hits < VALUE_CACHE_MIN_HITS)
+			former->typFastInput[col] = cache->input;
+		cache->lookups = cache->hits = 0;
+	}
+
+	return value;
+}
+
+/*
+ * Put a value cache in front of the converter of the column.
+ */
+static void
+SetValueCache(TupleFormer *former, int col)
+{
+	ValueCache *cache;
+
+	if (former->typCache[col] != NULL)
+		return;
+
+	if (former->cacheContext == NULL)
+		former->cacheContext = AllocSetContextCreate(CurrentMemoryContext,
+									"ValueCache",
+									ALLOCSET_DEFAULT_MINSIZE,
+									ALLOCSET_DEFAULT_INITSIZE,
+									ALLOCSET_DEFAULT_MAXSIZE);
+
+	cache = MemoryContextAllocZero(former->cacheContext, sizeof(ValueCache));
+	cache->input = former->typFastInput[col];
+	get_typlenbyval(former->typId[col], &cache->typlen, &cache->typbyval);
+	former->typCache[col] = cache;
+	former->typFastInput[col] = InputCached;
+}
+
+/*
+ * Enums and domains are cached by default.
+ */
+static bool
+IsCachedType(Oid typid)
+{
+	char	typtype = get_typtype(typid);
+
+	return typtype == TYPTYPE_ENUM || typtype == TYPTYPE_DOMAIN;
+}
+
+/*
+ * Choose the input converter for the type.
+ */
+static TupleFormerInputProc
+ChooseInputProc(Oid typid)
+{
+	switch (typid)
+	{
+		case INT2OID:
+			return InputInt2;
+		case INT4OID:
+			return InputInt4;
+		case INT8OID:
+			return InputInt8;
+#ifdef USE_FAST_FLOAT_INPUT
+		case FLOAT4OID:
+			return InputFloat4;
+		case FLOAT8OID:
+			return InputFloat8;
+#endif
+		case BOOLOID:
+			return InputBool;
+		case NUMERICOID:
+			return InputNumeric;
+		case TEXTOID:
+			return InputText;
+		default:
+			return InputByFunction;
+	}
+}
+
 void
 TupleFormerInit(TupleFormer *former, Filter *filter, TupleDesc desc)
 {
@@ -600,6 +1454,12 @@ TupleFormerInit(TupleFormer *former, Filter *filter, TupleDesc desc)
 	former->typId = (Oid *) palloc(natts * sizeof(Oid));
 	former->typIOParam = (Oid *) palloc(natts * sizeof(Oid));
 	former->typInput = (FmgrInfo *) palloc(natts * sizeof(FmgrInfo));
+	former->typFastInput = (TupleFormerInputProc *)
+		palloc(natts * sizeof(TupleFormerInputProc));
+	former->typFormat = (DateTimeFormat **)
+		palloc0(natts * sizeof(DateTimeFormat *));
+	former->typCache = (ValueCache **) palloc0(natts * sizeof(ValueCache *));
+	former->cacheContext = NULL;
 	former->typMod = (Oid *) palloc(natts * sizeof(Oid));
 	former->attnum = palloc(natts * sizeof(int));
 
@@ -618,6 +1478,9 @@ TupleFormerInit(TupleFormer *former, Filter *filter, TupleDesc desc)
 			former->typMod[i] = -1;
 			former->attnum[i] = i;
 			former->typId[i] = filter->argtypes[i];
+			former->typFastInput[i] = ChooseInputProc(former->typId[i]);
+			if (IsCachedType(former->typId[i]))
+				SetValueCache(former, i);
 		}
 	}
 	else
@@ -639,6 +1502,9 @@ TupleFormerInit(TupleFormer *former, Filter *filter, TupleDesc desc)
 
 			former->typMod[i] = attrs[i]->atttypmod;
 			former->typId[i] = attrs[i]->atttypid;
+			former->typFastInput[i] = ChooseInputProc(former->typId[i]);
+			if (IsCachedType(former->typId[i]))
+				SetValueCache(former, i);
 
 			/* update valid column information */
 			former->attnum[former->maxfields] = i;
@@ -649,6 +1515,104 @@ TupleFormerInit(TupleFormer *former, Filter *filter, TupleDesc desc)
 	}
 }
 
+/*
+ * Find a column by name.  Not available with FILTER.
+ */
+static int
+FindColumn(TupleFormer *former, const char *name)
+{
+	int		i;
+
+	for (i = 0; i < former->desc->natts; i++)
+	{
+		if (!former->desc->attrs[i]->attisdropped &&
+			strcmp(name, former->desc->attrs[i]->attname.data) == 0)
+			return i;
+	}
+
+	ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+					errmsg("invalid column name [%s]", name)));
+	return -1;	/* keep compiler quiet */
+}
+
+/*
+ * Set the DATETIME_FORMAT of a column.  spec is "column:format".  Must not
+ * be used with FILTER because function arguments have no names.
+ */
+void
+TupleFormerSetFormat(TupleFormer *former, const char *spec)
+{
+	const char *colon;
+	const char *format;
+	char	   *name;
+	int			len;
+	int			i;
+
+	colon = strchr(spec, ':');
+	if (colon == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("DATETIME_FORMAT must be \"column:format\": %s",
+						spec)));
+
+	/* trim spaces around the column name and before the format */
+	while (isspace((unsigned char) *spec))
+		spec++;
+	for (len = colon - spec; len > 0; len--)
+	{
+		if (!isspace((unsigned char) spec[len - 1]))
+			break;
+	}
+	name = palloc(len + 1);
+	memcpy(name, spec, len);
+	name[len] = '\0';
+
+	format = colon + 1;
+	while (isspace((unsigned char) *format))
+		format++;
+
+	i = FindColumn(former, name);
+
+	switch (former->typId[i])
+	{
+		case DATEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			break;
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("DATETIME_FORMAT cannot be used for column \"%s\" of type %s",
+							name, format_type_be(former->typId[i]))));
+	}
+
+	if (former->typFormat[i])
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("duplicate DATETIME_FORMAT for column \"%s\"", name)));
+
+#ifdef USE_DATETIME_FORMAT
+	former->typFormat[i] = CompileDateTimeFormat(format);
+	former->typFastInput[i] = InputDateTime;
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("DATETIME_FORMAT requires integer datetimes")));
+#endif
+
+	pfree(name);
+}
+
+/*
+ * Cache the converted values of a column in addition to the enums and
+ * domains.  Must not be used with FILTER.
+ */
+void
+TupleFormerSetCache(TupleFormer *former, const char *name)
+{
+	SetValueCache(former, FindColumn(former, name));
+}
+
 void
 TupleFormerTerm(TupleFormer *former)
 {
@@ -661,6 +1625,18 @@ TupleFormerTerm(TupleFormer *former)
 	if (former->typInput)
 		pfree(former->typInput);
 
+	if (former->typFastInput)
+		pfree(former->typFastInput);
+
+	if (former->typFormat)
+		pfree(former->typFormat);
+
+	if (former->typCache)
+		pfree(former->typCache);
+
+	if (former->cacheContext)
+		MemoryContextDelete(former->cacheContext);
+
 	if (former->values)
 		pfree(former->values);
 
@@ -680,6 +1656,62 @@ TupleFormerTuple(TupleFormer *former)
 	return heap_form_tuple(former->desc, former->values, former->isnull);
 }
 
+/*
+ * Form a tuple in the space reserved by placer, or in a palloc'd chunk as
+ * TupleFormerTuple if placer is NULL or declines.  Same as heap_form_tuple.
+ */
+HeapTuple
+TupleFormerPlace(TupleFormer *former, Writer *placer)
+{
+	TupleDesc		desc = former->desc;
+	HeapTuple		tuple;
+	HeapTupleHeader	td;
+	Size			len;
+	Size			data_len;
+	int				hoff;
+	bool			hasnull = false;
+	int				i;
+
+	if (placer == NULL)
+		return TupleFormerTuple(former);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		if (former->isnull[i])
+			hasnull = true;
+		else if (desc->attrs[i]->attlen == -1 &&
+				 VARATT_IS_EXTERNAL(DatumGetPointer(former->values[i])))
+			return TupleFormerTuple(former);
+	}
+
+	len = offsetof(HeapTupleHeaderData, t_bits);
+	if (hasnull)
+		len += BITMAPLEN(desc->natts);
+	if (desc->tdhasoid)
+		len += sizeof(Oid);
+	hoff = len = MAXALIGN(len);
+	data_len = heap_compute_data_size(desc, former->values, former->isnull);
+	len += data_len;
+
+	tuple = WriterReserve(placer, len);
+	if (tuple == NULL)
+		return TupleFormerTuple(former);
+
+	td = tuple->t_data;
+	HeapTupleHeaderSetDatumLength(td, len);
+	HeapTupleHeaderSetTypeId(td, desc->tdtypeid);
+	HeapTupleHeaderSetTypMod(td, desc->tdtypmod);
+	HeapTupleHeaderSetNatts(td, desc->natts);
+	td->t_hoff = hoff;
+	if (desc->tdhasoid)
+		td->t_infomask = HEAP_HASOID;
+
+	heap_fill_tuple(desc, former->values, former->isnull, (char *) td + hoff,
+					data_len, &td->t_infomask, (hasnull ? td->t_bits : NULL));
+
+	return tuple;
+}
+
 static HeapTuple
 TupleFormerNullTuple(TupleFormer *former)
 {
@@ -693,10 +1725,7 @@ TupleFormerNullTuple(TupleFormer *former)
 Datum
 TupleFormerValue(TupleFormer *former, const char *str, int col)
 {
-	return FunctionCall3(&former->typInput[col],
-		CStringGetDatum(str),
-		ObjectIdGetDatum(former->typIOParam[col]),
-		Int32GetDatum(former->typMod[col]));
+	return former->typFastInput[col](former, str, col);
 }
 
 /*
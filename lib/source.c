@@ -7,6 +7,11 @@
 #include "pg_bulkload.h"
 
 #include <fcntl.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif
 #include "pgut/pgut-pthread.h"
 
 #include "access/htup.h"
@@ -19,6 +24,7 @@
 #include "utils/memutils.h"
 
 #include "reader.h"
+#include "pg_profile.h"
 
 #include "pgut/pgut-be.h"
 
@@ -38,11 +44,25 @@ ProtocolVersion	FrontendProtocol = 3;
 /* ========================================================================
  * AsyncSource
  * ========================================================================*/
-#define SPIN_SLEEP_MSEC		10
+#define WAIT_TIMEOUT_MSEC	100
 #define READ_UNIT_SIZE		(1024 * 1024)
 #define INITIAL_BUF_LEN		(16 * READ_UNIT_SIZE)
 #define ERROR_MESSAGE_LEN	1024
 
+/*
+ * The read thread and the backend share a ring buffer.  Both sides block on
+ * condition variables instead of polling:
+ *
+ *  - The read thread sleeps on 'drained' only while the ring is full, that
+ *    is, while there is no room for another read (see AsyncSourceWritable).
+ *  - The backend sleeps on 'filled' only until 'wanted' bytes are available,
+ *    and the read thread does not wake it up before that watermark is met.
+ *
+ * begin, end, eof, errmsg and the members following 'lock' are protected by
+ * 'lock'.  The data in [begin, end) is owned by the backend and the free area
+ * is owned by the read thread, so the copies themselves are done without
+ * holding the lock.
+ */
 typedef struct AsyncSource
 {
 	Source	base;
@@ -69,11 +89,18 @@ typedef struct AsyncSource
 
 	pthread_t		th;
 	pthread_mutex_t	lock;
+	pthread_cond_t	filled;		/* the read thread added data */
+	pthread_cond_t	drained;	/* the backend consumed data */
+	size_t			wanted;		/* bytes the backend is waiting for */
+	bool			full;		/* the read thread is waiting for room */
+	bool			reading;	/* the read thread is in fread() */
 } AsyncSource;
 
 static size_t AsyncSourceRead(AsyncSource *self, void *buffer, size_t len);
 static void AsyncSourceClose(AsyncSource *self);
 static void *AsyncSourceMain(void *arg);
+static int AsyncSourceWritable(AsyncSource *self);
+static size_t AsyncSourceReadable(AsyncSource *self);
 
 /* ========================================================================
  * FileSource
@@ -89,6 +116,102 @@ typedef struct FileSource
 static size_t FileSourceRead(FileSource *self, void *buffer, size_t len);
 static void FileSourceClose(FileSource *self);
 
+/* ========================================================================
+ * DirectSource
+ * ========================================================================*/
+#define DIRECT_READ_UNIT	(4 * 1024 * 1024)	/* bytes per read request */
+#define DIRECT_READ_DEPTH	8		/* number of chunks in the ring */
+#define DIRECT_READ_THREADS	4		/* number of read threads */
+#define DIRECT_READ_ALIGN	4096	/* buffer and offset alignment */
+
+#ifdef O_DIRECT
+#define DIRECT_READ_FLAGS	O_DIRECT
+#else
+#define DIRECT_READ_FLAGS	0
+#endif
+
+typedef enum ChunkState
+{
+	CHUNK_EMPTY,
+	CHUNK_READING,
+	CHUNK_FILLED
+} ChunkState;
+
+typedef struct DirectChunk
+{
+	ChunkState	state;
+	int64		chunkno;	/* file offset / DIRECT_READ_UNIT */
+	size_t		len;		/* valid bytes in data */
+	char	   *data;		/* aligned DIRECT_READ_UNIT bytes */
+} DirectChunk;
+
+/*
+ * Reads the file bypassing the OS page cache.  Several read threads keep up
+ * to DIRECT_READ_DEPTH aligned reads in flight; chunk N is stored in slot
+ * N % DIRECT_READ_DEPTH and the backend consumes the chunks in file order.
+ */
+typedef struct DirectSource
+{
+	Source	base;
+
+	int		fd;
+	bool	eof;
+	char   *buffer;			/* unaligned allocation for all chunks */
+	size_t	pos;			/* consumed bytes in the current chunk */
+
+	DirectChunk	chunks[DIRECT_READ_DEPTH];
+	int64	next_chunk;		/* chunk to be consumed next */
+	int64	next_claim;		/* chunk to be read next */
+	int64	eof_chunk;		/* last chunk of the file, or -1 if unknown */
+	bool	quit;			/* read threads should exit */
+	char	errmsg[ERROR_MESSAGE_LEN];
+
+	pthread_t		th[DIRECT_READ_THREADS];
+	int				nthreads;
+	pthread_mutex_t	lock;
+	pthread_cond_t	filled;		/* a chunk has been read */
+	pthread_cond_t	drained;	/* a chunk has been consumed */
+} DirectSource;
+
+static size_t DirectSourceRead(DirectSource *self, void *buffer, size_t len);
+static void DirectSourceClose(DirectSource *self);
+static void *DirectSourceMain(void *arg);
+
+/* ========================================================================
+ * MmapSource
+ * ========================================================================*/
+#ifndef WIN32
+#define MMAP_WINDOW_SIZE	(64 * 1024 * 1024)	/* unit to drop pages */
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+
+/*
+ * Maps the whole file so that parsers can scan it in place.  The mapping is
+ * private and writable, and it is followed by at least one zeroed byte, so
+ * parsers may rely on a '\0' sentinel after the data and may write a few bytes
+ * at the end of the file.  Pages are dropped from memory in MMAP_WINDOW_SIZE
+ * units as the parser moves past them (see MmapSourceRelease).
+ */
+typedef struct MmapSource
+{
+	Source	base;
+
+	char   *addr;		/* start of the mapping */
+	size_t	size;		/* file size */
+	size_t	maplen;		/* length of the mapping including the sentinel */
+	size_t	pagesize;
+	size_t	pos;		/* consumed bytes by MmapSourceRead */
+	size_t	released;	/* pages before this offset have been dropped */
+} MmapSource;
+
+static size_t MmapSourceRead(MmapSource *self, void *buffer, size_t len);
+static void MmapSourceClose(MmapSource *self);
+static char *MmapSourceMap(MmapSource *self, size_t *len);
+static void MmapSourceRelease(MmapSource *self, size_t offset);
+#endif   /* WIN32 */
+
 /* ========================================================================
  * RemoteSource
  * ========================================================================*/
@@ -107,13 +230,51 @@ static void RemoteSourceClose(RemoteSource *self);
 
 static Source *CreateAsyncSource(const char *path, TupleDesc desc);
 static Source *CreateFileSource(const char *path, TupleDesc desc);
+static Source *CreateDirectSource(const char *path, TupleDesc desc);
+#ifndef WIN32
+static Source *CreateMmapSource(const char *path, TupleDesc desc);
+#endif
 static Source *CreateRemoteSource(const char *path, TupleDesc desc);
 
 static int Wrappered_pq_getbyte(void);
 static int Wrappered_pq_getbytes(char *s, size_t len);
 
+/*
+ * Wait for a worker thread.  The wait is bounded so that the backend keeps
+ * servicing interrupts even if the thread is stuck, ex. in a slow read.
+ * Must be called with the lock held.
+ */
+void
+WaitForThread(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+#ifndef WIN32
+	struct timeval	tv;
+	struct timespec	ts;
+
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec;
+	ts.tv_nsec = tv.tv_usec * 1000 + WAIT_TIMEOUT_MSEC * 1000000L;
+	while (ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(cond, lock, &ts);
+#else
+	pthread_cond_wait(cond, lock);
+#endif
+}
+
+const char *READ_METHOD_NAMES[3] =
+{
+	"BUFFERED",
+	"DIRECT",
+	"MMAP"
+};
+
 Source *
-CreateSource(const char *path, TupleDesc desc, bool async_read)
+CreateSource(const char *path, TupleDesc desc, bool async_read,
+			 READ_METHOD method)
 {
 	if (pg_strcasecmp(path, "stdin") == 0)
 	{
@@ -121,6 +282,11 @@ CreateSource(const char *path, TupleDesc desc, bool async_read)
 			ereport(ERROR,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 				 errmsg("local stdin read is not supported")));
+		if (method != READ_METHOD_BUFFERED)
+			ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("READ_METHOD = %s is not supported for stdin",
+						READ_METHOD_NAMES[method])));
 
 		return CreateRemoteSource(NULL, desc);
 	}
@@ -131,6 +297,20 @@ CreateSource(const char *path, TupleDesc desc, bool async_read)
 					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 					 errmsg("relative path not allowed for INPUT: %s", path)));
 
+		if (method == READ_METHOD_DIRECT)
+			return CreateDirectSource(path, desc);
+
+		if (method == READ_METHOD_MMAP)
+		{
+#ifndef WIN32
+			return CreateMmapSource(path, desc);
+#else
+			ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("READ_METHOD = MMAP is not supported on this platform")));
+#endif
+		}
+
 		if (async_read)
 			return CreateAsyncSource(path, desc);
 
@@ -180,6 +360,8 @@ CreateAsyncSource(const char *path, TupleDesc desc)
 #endif
 
 	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->filled, NULL);
+	pthread_cond_init(&self->drained, NULL);
 
 	if (pthread_create(&self->th, NULL, AsyncSourceMain, self) != 0)
 		elog(ERROR, "pthread_create");
@@ -187,14 +369,51 @@ CreateAsyncSource(const char *path, TupleDesc desc)
 	return (Source *) self;
 }
 
+/*
+ * Number of bytes the read thread may read into the ring at 'end' now,
+ * or 0 if the ring is full.  Must be called with the lock held.
+ */
+static int
+AsyncSourceWritable(AsyncSource *self)
+{
+	int		len;
+
+	if (self->begin > self->end)
+	{
+		len = self->begin - self->end;
+		if (len <= READ_UNIT_SIZE)
+			len = 0;
+	}
+	else
+	{
+		len = self->size - self->end;
+		if (self->begin == 0 && len <= READ_UNIT_SIZE)
+			len = 0;
+	}
+
+	return len;
+}
+
+/*
+ * Number of bytes ready for the backend.  Must be called with the lock held.
+ */
+static size_t
+AsyncSourceReadable(AsyncSource *self)
+{
+	if (self->begin <= self->end)
+		return self->end - self->begin;
+	else
+		return self->size - self->begin + self->end;
+}
+
 static size_t
 AsyncSourceRead(AsyncSource *self, void *buffer, size_t len)
 {
 	char   *data;
 	int		size;
 	int		begin;
-	int		end;
-	char	errhead;
+	size_t	avail;
+	bool	eof;
 	size_t	bytesread;
 	int		n;
 
@@ -216,6 +435,13 @@ AsyncSourceRead(AsyncSource *self, void *buffer, size_t len)
 
 		pthread_mutex_lock(&self->lock);
 
+		/* the read thread might be filling the old buffer */
+		while (self->reading)
+		{
+			self->wanted = 0;
+			pthread_cond_wait(&self->filled, &self->lock);
+		}
+
 		/* copy it in new buffer from old buffer */
 		if (self->begin > self->end)
 		{
@@ -235,6 +461,10 @@ AsyncSourceRead(AsyncSource *self, void *buffer, size_t len)
 		self->size = newsize;
 		self->begin = 0;
 
+		/* there is a room now */
+		if (self->full)
+			pthread_cond_signal(&self->drained);
+
 		pthread_mutex_unlock(&self->lock);
 
 		MemoryContextSwitchTo(oldcxt);
@@ -245,66 +475,77 @@ AsyncSourceRead(AsyncSource *self, void *buffer, size_t len)
 	size = self->size;
 	begin = self->begin;
 
-	bytesread = 0;
-retry:
-	end = self->end;
-	errhead = self->errmsg[0];
-
-	/* error in read thread */
-	if (errhead != '\0')
+	/*
+	 * Wait until the read thread has produced the requested bytes, or has
+	 * reached EOF or an error.
+	 */
+	pthread_mutex_lock(&self->lock);
+	for (;;)
 	{
-		/* wait for error message to be set */
-		pthread_mutex_lock(&self->lock);
+		avail = AsyncSourceReadable(self);
+		eof = self->eof;
+
+		if (self->errmsg[0] != '\0' || eof || avail >= len)
+			break;
+
+		self->wanted = len;
+		WaitForThread(&self->filled, &self->lock);
+		self->wanted = 0;
+
+		/* not enough data yet */
 		pthread_mutex_unlock(&self->lock);
+		CHECK_FOR_INTERRUPTS();
+		pthread_mutex_lock(&self->lock);
+	}
+	pthread_mutex_unlock(&self->lock);
+
+	BULKLOAD_PROFILE(&prof_reader_source);
 
+	/* error in read thread */
+	if (self->errmsg[0] != '\0')
 		ereport(ERROR,
 				(errcode_for_file_access(),
 				 errmsg("%s", self->errmsg)));
-	}
 
-	if (begin < end)
+	/* copy the data out of the ring, which might be wrapped around */
+	bytesread = 0;
+	avail = Min(avail, len);
+	while (bytesread < avail)
 	{
-		n = Min(len - bytesread, end - begin);
+		n = Min(avail - bytesread, size - begin);
 		memcpy((char *) buffer + bytesread, data + begin, n);
-		begin += n;
 		bytesread += n;
-	}
-	else if (begin > end)
-	{
-		n = Min(len - bytesread, size - begin);
-		memcpy((char *) buffer + bytesread, data + begin, n);
 		begin += n;
-		bytesread += n;
-
 		if (begin == size)
-		{
-			self->begin = begin = 0;
-
-			if (bytesread < len)
-				goto retry;
-		}
+			begin = 0;
 	}
 
+	pthread_mutex_lock(&self->lock);
 	self->begin = begin;
+	if (self->full && AsyncSourceWritable(self) > 0)
+		pthread_cond_signal(&self->drained);
+	pthread_mutex_unlock(&self->lock);
 
-	if (bytesread == len || (self->eof && begin == end))
-		return bytesread;
-
-	/* not enough data yet */
-	CHECK_FOR_INTERRUPTS();
-	pg_usleep(SPIN_SLEEP_MSEC * 1000);
+	Assert(bytesread == len || eof);
 
-	goto retry;
+	return bytesread;
 }
 
 static void
 AsyncSourceClose(AsyncSource *self)
 {
+	/* ask the read thread to quit */
+	pthread_mutex_lock(&self->lock);
 	self->eof = true;
-
+	pthread_cond_signal(&self->drained);
 	pthread_mutex_unlock(&self->lock);
+
 	pthread_join(self->th, NULL);
 
+	pthread_cond_destroy(&self->filled);
+	pthread_cond_destroy(&self->drained);
+	pthread_mutex_destroy(&self->lock);
+
 	if (self->fd != NULL && FreeFile(self->fd) < 0)
 	{
 		ereport(WARNING, (errcode_for_file_access(),
@@ -325,60 +566,53 @@ AsyncSourceMain(void *arg)
 {
 	AsyncSource   *self = (AsyncSource *) arg;
 	size_t			bytesread;
-	int				begin;
 	int				end;
-	int				size;
 	int				len;
 	char		   *data;
+	bool			failed;
+	bool			at_eof;
 
 	Assert(self->begin == 0);
 	Assert(self->end == 0);
 
+	pthread_mutex_lock(&self->lock);
+
 	for (;;)
 	{
-		pthread_mutex_lock(&self->lock);
-
-		begin = self->begin;
-		end = self->end;
-		size = self->size;
-		data = self->buffer;
-
-		if (begin > end)
-		{
-			len = begin - end;
-			if (len <= READ_UNIT_SIZE)
-				len = 0;
-		}
-		else
-		{
-			len = size - end;
-			if (begin == 0 && len <= READ_UNIT_SIZE)
-				len = 0;
-		}
+		if (self->eof)
+			break;
 
+		len = AsyncSourceWritable(self);
 		if (len == 0)
 		{
-			pthread_mutex_unlock(&self->lock);
-
-			if (self->eof)
-				break;
-
-			pg_usleep(SPIN_SLEEP_MSEC * 1000);
-
+			/* the ring is full; sleep until the backend consumes data */
+			self->full = true;
+			pthread_cond_wait(&self->drained, &self->lock);
+			self->full = false;
 			continue;
-			/* retry */
 		}
 
 		len = Min(len, READ_UNIT_SIZE);
+		end = self->end;
+		data = self->buffer;
+
+		/* the area is ours, so read it without holding the lock */
+		self->reading = true;
+		pthread_mutex_unlock(&self->lock);
 
 		bytesread = fread(data + end, 1, len, self->fd);
+		failed = ferror(self->fd);
+		at_eof = feof(self->fd);
 
-		if (ferror(self->fd))
+		pthread_mutex_lock(&self->lock);
+		self->reading = false;
+
+		if (failed)
 		{
 			snprintf(self->errmsg, ERROR_MESSAGE_LEN,
 					 "could not read from source file: %m");
-			pthread_mutex_unlock(&self->lock);
-			return NULL;
+			pthread_cond_signal(&self->filled);
+			break;
 		}
 
 		end += bytesread;
@@ -387,16 +621,12 @@ AsyncSourceMain(void *arg)
 
 		self->end = end;
 
-		if (feof(self->fd))
-		{
+		if (at_eof)
 			self->eof = true;
-			break;
-		}
-
-		if (self->eof)
-			break;
 
-		pthread_mutex_unlock(&self->lock);
+		/* wake up the backend only when its watermark is reached */
+		if (self->eof || AsyncSourceReadable(self) >= self->wanted)
+			pthread_cond_signal(&self->filled);
 	}
 
 	pthread_mutex_unlock(&self->lock);
@@ -452,6 +682,352 @@ FileSourceClose(FileSource *self)
 	pfree(self);
 }
 
+/* ========================================================================
+ * DirectSource
+ * ========================================================================*/
+
+static Source *
+CreateDirectSource(const char *path, TupleDesc desc)
+{
+	DirectSource   *self = palloc0(sizeof(DirectSource));
+	char		   *data;
+	int				i;
+
+	self->base.read = (SourceReadProc) DirectSourceRead;
+	self->base.close = (SourceCloseProc) DirectSourceClose;
+
+	self->eof = false;
+	self->pos = 0;
+	self->next_chunk = 0;
+	self->next_claim = 0;
+	self->eof_chunk = -1;
+	self->quit = false;
+	self->errmsg[0] = '\0';
+
+	/*
+	 * O_DIRECT is refused by some file systems, ex. tmpfs.  Then we still
+	 * read in parallel, but through the page cache.
+	 */
+	self->fd = BasicOpenFile((char *) path,
+							 O_RDONLY | DIRECT_READ_FLAGS | PG_BINARY, 0);
+	if (self->fd == -1 && errno == EINVAL)
+		self->fd = BasicOpenFile((char *) path, O_RDONLY | PG_BINARY, 0);
+	if (self->fd == -1)
+		ereport(ERROR, (errcode_for_file_access(),
+			errmsg("could not open \"%s\" %m", path)));
+
+	self->buffer = palloc(DIRECT_READ_UNIT * DIRECT_READ_DEPTH +
+						  DIRECT_READ_ALIGN);
+	data = (char *) TYPEALIGN(DIRECT_READ_ALIGN, self->buffer);
+	for (i = 0; i < DIRECT_READ_DEPTH; i++)
+	{
+		self->chunks[i].state = CHUNK_EMPTY;
+		self->chunks[i].chunkno = -1;
+		self->chunks[i].len = 0;
+		self->chunks[i].data = data + (size_t) DIRECT_READ_UNIT * i;
+	}
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->filled, NULL);
+	pthread_cond_init(&self->drained, NULL);
+
+	for (i = 0; i < DIRECT_READ_THREADS; i++)
+	{
+		if (pthread_create(&self->th[i], NULL, DirectSourceMain, self) != 0)
+		{
+			DirectSourceClose(self);
+			elog(ERROR, "pthread_create");
+		}
+		self->nthreads++;
+	}
+
+	return (Source *) self;
+}
+
+static size_t
+DirectSourceRead(DirectSource *self, void *buffer, size_t len)
+{
+	size_t	bytesread = 0;
+
+	while (bytesread < len && !self->eof)
+	{
+		DirectChunk	   *chunk;
+		size_t			n;
+
+		chunk = &self->chunks[self->next_chunk % DIRECT_READ_DEPTH];
+
+		/* wait for the chunk to be read */
+		pthread_mutex_lock(&self->lock);
+		while (self->errmsg[0] == '\0' &&
+			   (chunk->state != CHUNK_FILLED ||
+				chunk->chunkno != self->next_chunk))
+		{
+			WaitForThread(&self->filled, &self->lock);
+
+			pthread_mutex_unlock(&self->lock);
+			CHECK_FOR_INTERRUPTS();
+			pthread_mutex_lock(&self->lock);
+		}
+		pthread_mutex_unlock(&self->lock);
+
+		if (self->errmsg[0] != '\0')
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("%s", self->errmsg)));
+
+		n = Min(len - bytesread, chunk->len - self->pos);
+		memcpy((char *) buffer + bytesread, chunk->data + self->pos, n);
+		bytesread += n;
+		self->pos += n;
+
+		if (self->pos == chunk->len)
+		{
+			/* a short chunk is the last one */
+			if (chunk->len < DIRECT_READ_UNIT)
+				self->eof = true;
+
+			/* give the slot back to the read threads */
+			pthread_mutex_lock(&self->lock);
+			chunk->state = CHUNK_EMPTY;
+			self->next_chunk++;
+			self->pos = 0;
+			pthread_cond_broadcast(&self->drained);
+			pthread_mutex_unlock(&self->lock);
+		}
+	}
+
+	BULKLOAD_PROFILE(&prof_reader_source);
+
+	return bytesread;
+}
+
+static void
+DirectSourceClose(DirectSource *self)
+{
+	int		i;
+
+	/* ask the read threads to quit */
+	pthread_mutex_lock(&self->lock);
+	self->quit = true;
+	pthread_cond_broadcast(&self->drained);
+	pthread_mutex_unlock(&self->lock);
+
+	for (i = 0; i < self->nthreads; i++)
+		pthread_join(self->th[i], NULL);
+
+	pthread_cond_destroy(&self->filled);
+	pthread_cond_destroy(&self->drained);
+	pthread_mutex_destroy(&self->lock);
+
+	if (self->fd != -1 && close(self->fd) < 0)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+			errmsg("could not close source file: %m")));
+	}
+
+	if (self->buffer != NULL)
+		pfree(self->buffer);
+
+	pfree(self);
+}
+
+static void *
+DirectSourceMain(void *arg)
+{
+	DirectSource   *self = (DirectSource *) arg;
+
+	pthread_mutex_lock(&self->lock);
+
+	for (;;)
+	{
+		DirectChunk	   *chunk;
+		int64			chunkno;
+		off_t			offset;
+		size_t			total;
+		ssize_t			len;
+
+		if (self->quit || self->errmsg[0] != '\0' ||
+			(self->eof_chunk >= 0 && self->next_claim > self->eof_chunk))
+			break;
+
+		/* wait for the slot of the next chunk to be consumed */
+		chunk = &self->chunks[self->next_claim % DIRECT_READ_DEPTH];
+		if (chunk->state != CHUNK_EMPTY)
+		{
+			pthread_cond_wait(&self->drained, &self->lock);
+			continue;
+		}
+
+		chunkno = self->next_claim++;
+		chunk->state = CHUNK_READING;
+		chunk->chunkno = chunkno;
+		pthread_mutex_unlock(&self->lock);
+
+		/*
+		 * Read the whole chunk.  With O_DIRECT every request must start at an
+		 * aligned offset, so an unaligned short read can only mean EOF.
+		 */
+		offset = (off_t) chunkno * DIRECT_READ_UNIT;
+		total = 0;
+		len = 0;
+		while (total < DIRECT_READ_UNIT)
+		{
+			len = pread(self->fd, chunk->data + total,
+						DIRECT_READ_UNIT - total, offset + total);
+			if (len < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			total += len;
+			if (len == 0 || len % DIRECT_READ_ALIGN != 0)
+				break;
+		}
+
+		pthread_mutex_lock(&self->lock);
+
+		if (len < 0)
+		{
+			snprintf(self->errmsg, ERROR_MESSAGE_LEN,
+					 "could not read from source file: %s", strerror(errno));
+			pthread_cond_broadcast(&self->filled);
+			pthread_cond_broadcast(&self->drained);
+			break;
+		}
+
+		chunk->len = total;
+		chunk->state = CHUNK_FILLED;
+		if (total < DIRECT_READ_UNIT &&
+			(self->eof_chunk < 0 || chunkno < self->eof_chunk))
+			self->eof_chunk = chunkno;
+
+		pthread_cond_broadcast(&self->filled);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return NULL;
+}
+
+/* ========================================================================
+ * MmapSource
+ * ========================================================================*/
+
+#ifndef WIN32
+static Source *
+CreateMmapSource(const char *path, TupleDesc desc)
+{
+	MmapSource	   *self = palloc0(sizeof(MmapSource));
+	struct stat		st;
+	int				fd;
+
+	self->base.read = (SourceReadProc) MmapSourceRead;
+	self->base.close = (SourceCloseProc) MmapSourceClose;
+	self->base.map = (SourceMapProc) MmapSourceMap;
+	self->base.release = (SourceReleaseProc) MmapSourceRelease;
+
+	fd = BasicOpenFile((char *) path, O_RDONLY | PG_BINARY, 0);
+	if (fd == -1)
+		ereport(ERROR, (errcode_for_file_access(),
+			errmsg("could not open \"%s\" %m", path)));
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("READ_METHOD = MMAP requires a regular file: \"%s\"",
+						path)));
+	}
+
+	self->size = st.st_size;
+	self->pagesize = sysconf(_SC_PAGESIZE);
+	self->maplen = TYPEALIGN(self->pagesize, self->size) + self->pagesize;
+
+	/*
+	 * Reserve the address space with zeroed pages first, then map the file
+	 * over the head of it.  The trailing zero page provides the sentinel even
+	 * if the file size is a multiple of the page size.
+	 */
+	self->addr = mmap(NULL, self->maplen, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (self->addr == MAP_FAILED ||
+		(self->size > 0 &&
+		 mmap(self->addr, self->size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+	{
+		int		save_errno = errno;
+
+		if (self->addr != MAP_FAILED)
+			munmap(self->addr, self->maplen);
+		close(fd);
+		errno = save_errno;
+		ereport(ERROR, (errcode_for_file_access(),
+			errmsg("could not map \"%s\" %m", path)));
+	}
+
+	/* the mapping holds its own reference to the file */
+	close(fd);
+
+#ifdef MADV_SEQUENTIAL
+	if (self->size > 0)
+		madvise(self->addr, self->size, MADV_SEQUENTIAL);
+#endif
+
+	return (Source *) self;
+}
+
+static size_t
+MmapSourceRead(MmapSource *self, void *buffer, size_t len)
+{
+	len = Min(len, self->size - self->pos);
+	memcpy(buffer, self->addr + self->pos, len);
+	self->pos += len;
+	MmapSourceRelease(self, self->pos);
+
+	return len;
+}
+
+static void
+MmapSourceClose(MmapSource *self)
+{
+	if (munmap(self->addr, self->maplen) < 0)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+			errmsg("could not unmap source file: %m")));
+	}
+	pfree(self);
+}
+
+static char *
+MmapSourceMap(MmapSource *self, size_t *len)
+{
+	*len = self->size;
+	return self->addr;
+}
+
+/*
+ * The caller no longer needs the data before offset.  Pages are dropped in
+ * windows so that madvise is not called for every record.
+ */
+static void
+MmapSourceRelease(MmapSource *self, size_t offset)
+{
+	size_t	end;
+
+	offset = Min(offset, self->size);
+	if (offset < self->released + MMAP_WINDOW_SIZE)
+		return;
+
+	end = offset - offset % self->pagesize;
+#ifdef MADV_DONTNEED
+	madvise(self->addr + self->released, end - self->released, MADV_DONTNEED);
+#endif
+	self->released = end;
+}
+#endif   /* WIN32 */
+
 /* ========================================================================
  * RemoteSource
  * ========================================================================*/
@@ -24,6 +24,13 @@ const char *ON_DUPLICATE_NAMES[] =
 	"OLD"
 };
 
+const char *INDEX_UPDATE_NAMES[] =
+{
+	"AUTO",
+	"REBUILD",
+	"INSERT"
+};
+
 /**
  * @brief Create Writer
  */
@@ -72,6 +79,24 @@ WriterInit(Writer *self)
 	self->init(self);
 }
 
+/**
+ * @brief Insert tuples.  Writers without insertBatch insert them one by one.
+ */
+void
+WriterInsertBatch(Writer *self, HeapTuple *tuples, int ntuples)
+{
+	int		i;
+
+	if (self->insertBatch)
+	{
+		self->insertBatch(self, tuples, ntuples);
+		return;
+	}
+
+	for (i = 0; i < ntuples; i++)
+		WriterInsert(self, tuples[i]);
+}
+
 /**
  * @brief Parse a line in control file.
  */
@@ -32,6 +32,7 @@ typedef struct BufferedWriter
 
 static void	BufferedWriterInit(BufferedWriter *self);
 static void	BufferedWriterInsert(BufferedWriter *self, HeapTuple tuple);
+static void	BufferedWriterInsertBatch(BufferedWriter *self, HeapTuple *tuples, int ntuples);
 static WriterResult	BufferedWriterClose(BufferedWriter *self, bool onError);
 static bool	BufferedWriterParam(BufferedWriter *self, const char *keyword, char *value);
 static void	BufferedWriterDumpParams(BufferedWriter *self);
@@ -50,6 +51,7 @@ CreateBufferedWriter(void *opt)
 	BufferedWriter *self = palloc0(sizeof(BufferedWriter));
 	self->base.init = (WriterInitProc) BufferedWriterInit;
 	self->base.insert = (WriterInsertProc) BufferedWriterInsert;
+	self->base.insertBatch = (WriterInsertBatchProc) BufferedWriterInsertBatch;
 	self->base.close = (WriterCloseProc) BufferedWriterClose;
 	self->base.param = (WriterParamProc) BufferedWriterParam;
 	self->base.dumpParams = (WriterDumpParamsProc) BufferedWriterDumpParams;
@@ -73,11 +75,20 @@ BufferedWriterInit(BufferedWriter *self)
 
 	self->base.rel = heap_open(self->base.relid, AccessExclusiveLock);
 	VerifyTarget(self->base.rel, self->base.max_dup_errors);
+#if PG_VERSION_NUM >= 100000
+	if (self->base.rel->rd_rel->relkind == RELKIND_PARTITIONED_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot load to partitioned table \"%s\" with WRITER = BUFFERED",
+						RelationGetRelationName(self->base.rel)),
+				 errhint("Use WRITER = DIRECT.")));
+#endif
 
 	self->base.desc = RelationGetDescr(self->base.rel);
 
 	SpoolerOpen(&self->spooler, self->base.rel, true, self->base.on_duplicate,
-				self->base.max_dup_errors, self->base.dup_badfile);
+				self->base.max_dup_errors, self->base.dup_badfile,
+				self->base.index_update);
 	self->base.context = GetPerTupleMemoryContext(self->spooler.estate);
 
 	self->bistate = GetBulkInsertState();
@@ -98,6 +109,32 @@ BufferedWriterInsert(BufferedWriter *self, HeapTuple tuple)
 	SpoolerInsert(&self->spooler, tuple);
 }
 
+/**
+ * @brief Store a batch of tuples into the heap using shared buffers.
+ *
+ * heap_multi_insert fills each page with as many tuples as fit under one
+ * buffer lock and one WAL record, instead of a lock, a page lookup and a
+ * WAL record for each tuple.  It sets t_self of the tuples, so the index
+ * entries are spooled after it.
+ * @return void
+ */
+static void
+BufferedWriterInsertBatch(BufferedWriter *self, HeapTuple *tuples, int ntuples)
+{
+	int		i;
+
+#if PG_VERSION_NUM >= 90200
+	heap_multi_insert(self->base.rel, tuples, ntuples, self->cid, 0,
+					  self->bistate);
+#else
+	for (i = 0; i < ntuples; i++)
+		heap_insert(self->base.rel, tuples[i], self->cid, 0, self->bistate);
+#endif
+
+	for (i = 0; i < ntuples; i++)
+		SpoolerInsert(&self->spooler, tuples[i]);
+}
+
 static WriterResult
 BufferedWriterClose(BufferedWriter *self, bool onError)
 {
@@ -155,6 +192,17 @@ BufferedWriterParam(BufferedWriter *self, const char *keyword, char *value)
 
 		self->base.on_duplicate = values[choice(keyword, value, ON_DUPLICATE_NAMES, lengthof(values))];
 	}
+	else if (CompareKeyword(keyword, "INDEX_UPDATE"))
+	{
+		const INDEX_UPDATE values[] =
+		{
+			INDEX_UPDATE_AUTO,
+			INDEX_UPDATE_REBUILD,
+			INDEX_UPDATE_INSERT
+		};
+
+		self->base.index_update = values[choice(keyword, value, INDEX_UPDATE_NAMES, lengthof(values))];
+	}
 	else if (CompareKeyword(keyword, "TRUNCATE"))
 	{
 		self->base.truncate = ParseBoolean(value);
@@ -188,6 +236,10 @@ BufferedWriterDumpParams(BufferedWriter *self)
 	appendStringInfo(&buf, "ON_DUPLICATE_KEEP = %s\n",
 					 ON_DUPLICATE_NAMES[self->base.on_duplicate]);
 
+	if (self->base.index_update != INDEX_UPDATE_AUTO)
+		appendStringInfo(&buf, "INDEX_UPDATE = %s\n",
+						 INDEX_UPDATE_NAMES[self->base.index_update]);
+
 	appendStringInfo(&buf, "TRUNCATE = %s\n",
 					 self->base.truncate ? "YES" : "NO");
 
@@ -198,7 +250,7 @@ BufferedWriterDumpParams(BufferedWriter *self)
 static int
 BufferedWriterSendQuery(BufferedWriter *self, PGconn *conn, char *queueName, char *logfile, bool verbose)
 {
-	const char *params[8];
+	const char *params[9];
 	char		max_dup_errors[MAXINT8LEN + 1];
 
 	if (self->base.max_dup_errors < -1)
@@ -216,6 +268,7 @@ BufferedWriterSendQuery(BufferedWriter *self, PGconn *conn, char *queueName, cha
 	params[5] = logfile;
 	params[6] = verbose ? "true" : "no";
 	params[7] = (self->base.truncate ? "true" : "no");
+	params[8] = INDEX_UPDATE_NAMES[self->base.index_update];
 
 	return PQsendQueryParams(conn,
 		"SELECT * FROM pg_bulkload(ARRAY["
@@ -228,6 +281,7 @@ BufferedWriterSendQuery(BufferedWriter *self, PGconn *conn, char *queueName, cha
 		"'DUPLICATE_BADFILE=' || $5,"
 		"'LOGFILE=' || $6,"
 		"'VERBOSE=' || $7,"
-		"'TRUNCATE=' || $8])",
-		8, NULL, params, NULL, NULL, 0);
+		"'TRUNCATE=' || $8,"
+		"'INDEX_UPDATE=' || $9])",
+		9, NULL, params, NULL, NULL, 0);
 }
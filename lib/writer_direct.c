@@ -24,12 +24,14 @@
 #include "utils/builtins.h"
 #include "utils/rel.h"
 #include "storage/bufpage.h"
+#include "storage/freespace.h"
 
 #include "logger.h"
 #include "pg_loadstatus.h"
 #include "reader.h"
 #include "writer.h"
 #include "pg_btree.h"
+#include "pg_compress.h"
 #include "pg_profile.h"
 #include "pg_strutil.h"
 #include "pgut/pgut-be.h"
@@ -45,6 +47,29 @@
 #include "access/xloginsert.h"
 #endif
 
+#if PG_VERSION_NUM >= 90600
+#include "access/visibilitymap.h"
+#endif
+
+#if PG_VERSION_NUM >= 110000
+#include "catalog/pg_inherits.h"
+#include "utils/partcache.h"
+#elif PG_VERSION_NUM >= 100000
+#include "catalog/partition.h"
+#include "catalog/pg_inherits_fn.h"
+#elif PG_VERSION_NUM >= 90000
+#include "catalog/pg_inherits_fn.h"
+#endif
+
+#if PG_VERSION_NUM >= 90000
+#include "access/tupconvert.h"
+#include "optimizer/clauses.h"
+#else
+/* PARTITION is not supported */
+typedef void TupleConversionMap;
+#define do_convert_tuple(tuple, map)	(tuple)
+#endif
+
 #if PG_VERSION_NUM >= 90400
 
 #define log_newpage(rnode, forknum, blk, page) \
@@ -68,6 +93,94 @@
 	(((PageHeader) (page))->pd_checksum = (uint16) (0))
 #endif
 
+/**
+ * @brief A write of contiguous blocks in an arena to a data file
+ */
+typedef struct ArenaWrite
+{
+	int				fd;			/**< File descriptor of data file */
+	int				first;		/**< Index of the first block in the arena */
+	int				nblocks;	/**< Number of blocks, or 0 to only close */
+	BlockNumber		segblk;		/**< Block number in the data file */
+	BlockNumber		blkno;		/**< Block number in the relation */
+	bool			close;		/**< Sync and close fd after the write */
+} ArenaWrite;
+
+/*
+ * An arena holds at most RELSEG_SIZE blocks, so that it crosses at most one
+ * segment boundary: close, write, close and write.
+ */
+#define MAX_ARENA_WRITES	4
+
+/**
+ * @brief Block buffer filled by the writer and written by the flush thread
+ */
+typedef struct BlockArena
+{
+	char		   *blocks;		/**< Local heap block buffer */
+	bool			submitted;	/**< Waiting for or being written */
+	bool			checksum;	/**< Set checksums before the writes? */
+	int				error;		/**< errno of a failed write, or 0 */
+	int				nwrites;	/**< Number of writes */
+	ArenaWrite		writes[MAX_ARENA_WRITES];
+} BlockArena;
+
+/**
+ * @brief A value to be compressed by a compression thread
+ */
+typedef struct CompressJob
+{
+	int				attnum;		/**< Index of the attribute in the tuple */
+	const char	   *source;		/**< Data of the value */
+	int32			slen;		/**< Size of the data */
+	struct varlena *dest;		/**< Buffer of COMPRESS_BUFSIZE(slen) */
+	int				state;		/**< JOB_WAITING, JOB_RUNNING or JOB_DONE */
+	bool			compressed;	/**< dest has the compressed value? */
+} CompressJob;
+
+#define JOB_WAITING		0
+#define JOB_RUNNING		1
+#define JOB_DONE		2
+
+/**
+ * @brief Compression threads working ahead of the insertions
+ *
+ * Jobs of a batch are claimed in order by the threads.  The backend inserts
+ * the tuples in order and waits only for the jobs of the current tuple, or
+ * runs them by itself if no thread has claimed them yet.
+ */
+typedef struct CompressPool
+{
+	PGLZWorkspace  *ws;			/**< Workspace for the backend */
+	pthread_t	   *th;
+	int				nthreads;
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;		/**< Jobs were submitted */
+	pthread_cond_t	done;		/**< A job has been done */
+
+	/* the members below are protected by lock */
+	CompressJob	   *jobs;		/**< Jobs of the current batch */
+	int				njobs;		/**< Number of jobs */
+	int				next;		/**< Next job to be claimed */
+	bool			quit;
+} CompressPool;
+
+/**
+ * @brief A child table to which tuples are routed
+ */
+typedef struct PartRoute
+{
+	Relation			rel;		/**< Child table */
+	TupleConversionMap *map;		/**< From the parent's rowtype, or NULL */
+	TupleTableSlot	   *slot;		/**< Slot of the child's rowtype */
+#if PG_VERSION_NUM >= 100000
+	ExprState		   *qual;		/**< Constraints of the child */
+#else
+	List			   *qual;		/**< Constraints of the child */
+#endif
+	struct DirectWriter *writer;	/**< Created at the first tuple, or NULL */
+} PartRoute;
+
 /**
  * @brief Heap loader using direct path
  */
@@ -80,23 +193,119 @@ typedef struct DirectWriter
 	LoadStatus		ls;
 	int				lsf_fd;		/**< File descriptor of load status file */
 	char			lsf_path[MAXPGPATH];	/**< Load status file path */
+	int				lsf_reserve;	/**< Blocks reserved ahead in the LSF */
+	BlockNumber		lsf_cnt;	/**< create_cnt recorded in the LSF */
 
 	TransactionId	xid;
 	CommandId		cid;
+	bool			freeze;		/**< Load frozen and all-visible tuples? */
+	bool			fresh;		/**< Relfilenode created in this transaction? */
+	HeapTuple		reserved;	/**< Tuple being formed in place, or NULL */
+
+	/*
+	 * With FREEZE, the visibility map fork is written directly.  Heap blocks
+	 * are appended to an empty relation, so the map is built page by page.
+	 */
+	Page			vmpage;		/**< Visibility map page being filled */
+	BlockNumber		vmblk;		/**< Block number of vmpage */
+	int				vmfd;		/**< File descriptor of visibility map */
+
+	/*
+	 * Chunks of toasted values are written by another DirectWriter for the
+	 * TOAST table, with its own load status file and index spooler.
+	 */
+	struct DirectWriter *toast;	/**< Writer for the TOAST table, or NULL */
+
+	/*
+	 * Tuples for a partitioned table, or an inheritance parent with PARTITION,
+	 * are routed to the child table whose constraints they satisfy, and are
+	 * written by another DirectWriter created for each child table.
+	 */
+	bool			partition;	/**< Route tuples to the child tables? */
+	PartRoute	   *routes;		/**< Array of the child tables */
+	int				nroutes;	/**< Number of the child tables */
+	int				lastroute;	/**< Index of the last child table routed */
+	bool			disjoint;	/**< Routes are partitions that never overlap? */
+	EState		   *route_estate;	/**< To evaluate the constraints */
+
+	int				compress_threads;	/**< Number of compression threads */
+	CompressPool   *compress;	/**< Compression threads, or NULL */
 
 	int				datafd;		/**< File descriptor of data file */
+	BlockNumber		prealloc_end;	/**< End of preallocated blocks */
+	bool			prealloc_failed;	/**< fallocate is not available? */
 
-	char		   *blocks;		/**< Local heap block buffer */
+	char		   *blocks;		/**< Block buffer of the current arena */
 	int				curblk;		/**< Index of the current block buffer */
+	int				nblocks;	/**< Number of blocks in an arena */
+
+	/*
+	 * While one arena is filled, the others are written to the data files by
+	 * the flush thread in the order they were filled.  With one arena, it is
+	 * written synchronously without the thread.
+	 */
+	BlockArena	   *arenas;		/**< Array of block arenas */
+	int				narenas;	/**< Number of arenas */
+	int				curarena;	/**< Index of the arena being filled */
+	bool			flush_started;	/**< Flush thread is running? */
+	bool			flush_stop;		/**< Flush thread should exit? */
+	bool			flush_abort;	/**< Discard submitted arenas? */
+	pthread_t		flush_th;
+	pthread_mutex_t	flush_lock;
+	pthread_cond_t	flush_cond;		/**< Arena submitted or written */
 } DirectWriter;
 
 /**
- * @brief Number of the block buffer
+ * @brief Default number of blocks in an arena
  */
 #define BLOCK_BUF_NUM		1024
 
+/**
+ * @brief Default and max number of arenas
+ */
+#define DEFAULT_BLOCK_BUFFERS	2
+#define MAX_BLOCK_BUFFERS		64
+
+/* an arena must fit in a palloc chunk and a segment */
+#define MAX_BLOCK_BUFFER_SIZE	Min(RELSEG_SIZE, MaxAllocSize / BLCKSZ)
+
+/* max number of compression threads */
+#define MAX_COMPRESS_THREADS	64
+
+/* LSF_RESERVE is not specified */
+#define LSF_RESERVE_UNSET		(-1)
+
+/*
+ * Layout of the visibility map, taken from access/heap/visibilitymap.c.
+ */
+#if PG_VERSION_NUM >= 90600
+#define VM_BITS_PER_HEAPBLOCK	2
+#define VM_ALL_BITS		(VISIBILITYMAP_ALL_VISIBLE | VISIBILITYMAP_ALL_FROZEN)
+#else
+#define VM_BITS_PER_HEAPBLOCK	1
+#define VM_ALL_BITS		0x01
+#endif
+#define VM_MAPSIZE				(BLCKSZ - MAXALIGN(SizeOfPageHeaderData))
+#define VM_HEAPBLOCKS_PER_BYTE	(BITS_PER_BYTE / VM_BITS_PER_HEAPBLOCK)
+#define VM_HEAPBLOCKS_PER_PAGE	(VM_MAPSIZE * VM_HEAPBLOCKS_PER_BYTE)
+#define VM_HEAPBLK_TO_MAPBLOCK(x)	((x) / VM_HEAPBLOCKS_PER_PAGE)
+#define VM_HEAPBLK_TO_MAPBYTE(x) \
+	(((x) % VM_HEAPBLOCKS_PER_PAGE) / VM_HEAPBLOCKS_PER_BYTE)
+#define VM_HEAPBLK_TO_OFFSET(x) \
+	(((x) % VM_HEAPBLOCKS_PER_BYTE) * VM_BITS_PER_HEAPBLOCK)
+
+/*
+ * Number of blocks preallocated ahead of the writes.  Preallocated space
+ * beyond the last block is released when the data file is closed.
+ */
+#define PREALLOC_BLOCKS			(64 * 1024 * 1024 / BLCKSZ)
+
 static void	DirectWriterInit(DirectWriter *self);
 static void	DirectWriterInsert(DirectWriter *self, HeapTuple tuple);
+static void	DirectWriterInsertBatch(DirectWriter *self, HeapTuple *tuples, int ntuples);
+static HeapTuple DirectWriterReserve(DirectWriter *self, Size len);
+static void	DirectWriterConfirm(DirectWriter *self, HeapTuple tuple);
+static void	DirectWriterCancel(DirectWriter *self);
 static WriterResult	DirectWriterClose(DirectWriter *self, bool onError);
 static bool	DirectWriterParam(DirectWriter *self, const char *keyword, char *value);
 static void	DirectWriterDumpParams(DirectWriter *self);
@@ -113,9 +322,41 @@ static int	DirectWriterSendQuery(DirectWriter *self, PGconn *conn, char *queueNa
 #define LS_TOTAL_CNT(ls)	((ls)->ls.exist_cnt + (ls)->ls.create_cnt)
 
 /* Signature of static functions */
-static int	open_data_file(RelFileNode rnode, bool istemp, BlockNumber blknum);
+static int	open_data_file(RelFileNode rnode, bool istemp, ForkNumber forknum, BlockNumber blknum);
+static void	prealloc_data_file(DirectWriter *loader, BlockNumber blknum, int num);
 static void	flush_pages(DirectWriter *loader);
+static void	next_arena(DirectWriter *loader);
+static void	wait_arena(DirectWriter *loader, BlockArena *arena);
+static void	check_arena(BlockArena *arena);
+static void	write_arena(BlockArena *arena, bool abort);
+static void	stop_flush_thread(DirectWriter *loader, bool abort);
+static void *FlushThreadMain(void *arg);
 static void	close_data_file(DirectWriter *loader);
+static void	open_target(DirectWriter *self);
+static DirectWriter *create_toast_writer(DirectWriter *parent);
+static void	open_routes(DirectWriter *self);
+static int	compare_routes(const void *a, const void *b);
+static PartRoute *route_tuple(DirectWriter *self, HeapTuple *tuple);
+static DirectWriter *create_part_writer(DirectWriter *parent, Relation rel);
+static void	close_routes(DirectWriter *self, bool onError, WriterResult *ret);
+static void	insert_tuple(DirectWriter *self, HeapTuple tuple, CompressJob *jobs, int njobs);
+static Page	get_insert_page(DirectWriter *self, Size len);
+static void	set_tuple_header(DirectWriter *self, HeapTupleHeader td);
+static bool	is_reserved_tuple(DirectWriter *self, HeapTuple tuple);
+static HeapTuple toast_tuple(DirectWriter *self, HeapTuple tuple, CompressJob *jobs, int njobs);
+static Size	toast_max_data_len(TupleDesc desc, bool *isnull);
+static int	plan_compress_jobs(DirectWriter *self, HeapTuple tuple, CompressJob *jobs, Datum *values, bool *isnull);
+static Datum compress_datum(DirectWriter *self, Datum value, int attnum, CompressJob *jobs, int njobs);
+static void	start_compress_threads(DirectWriter *self);
+static void	stop_compress_threads(DirectWriter *self);
+static void	submit_compress_jobs(CompressPool *pool, CompressJob *jobs, int njobs);
+static void	wait_compress_job(CompressPool *pool, CompressJob *job);
+static void	finish_compress_jobs(CompressPool *pool);
+static void *CompressThreadMain(void *arg);
+static Datum save_toast_datum(DirectWriter *self, Datum value);
+static void	set_all_visible(DirectWriter *loader, BlockNumber start, int num);
+static void	write_vm_page(DirectWriter *loader);
+static void	close_vm_file(DirectWriter *loader, bool onError);
 static void	UpdateLSF(DirectWriter *loader, BlockNumber num);
 static void UnlinkLSF(DirectWriter *loader);
 
@@ -134,14 +375,16 @@ CreateDirectWriter(void *opt)
 	self = palloc0(sizeof(DirectWriter));
 	self->base.init = (WriterInitProc) DirectWriterInit;
 	self->base.insert = (WriterInsertProc) DirectWriterInsert,
+	self->base.insertBatch = (WriterInsertBatchProc) DirectWriterInsertBatch,
 	self->base.close = (WriterCloseProc) DirectWriterClose,
 	self->base.param = (WriterParamProc) DirectWriterParam;
 	self->base.dumpParams = (WriterDumpParamsProc) DirectWriterDumpParams,
 	self->base.sendQuery = (WriterSendQueryProc) DirectWriterSendQuery;
 	self->base.max_dup_errors = -2;
 	self->lsf_fd = -1;
+	self->lsf_reserve = LSF_RESERVE_UNSET;
 	self->datafd = -1;
-	self->blocks = palloc(BLCKSZ * BLOCK_BUF_NUM);
+	self->vmfd = -1;
 	self->curblk = 0;
 
 	return (Writer *) self;
@@ -153,26 +396,86 @@ CreateDirectWriter(void *opt)
 static void
 DirectWriterInit(DirectWriter *self)
 {
-	LoadStatus		   *ls;
-
 	/*
 	 * Set defaults to unspecified parameters.
 	 */
 	if (self->base.max_dup_errors < -1)
 		self->base.max_dup_errors = DEFAULT_MAX_DUP_ERRORS;
+	if (self->narenas <= 0)
+		self->narenas = DEFAULT_BLOCK_BUFFERS;
+	if (self->nblocks <= 0)
+		self->nblocks = BLOCK_BUF_NUM;
+	if (self->lsf_reserve == LSF_RESERVE_UNSET)
+		self->lsf_reserve = 0;
+	if (self->compress_threads <= 0)
+		self->compress_threads = 1;
 
 	self->base.rel = heap_open(self->base.relid, AccessExclusiveLock);
 	VerifyTarget(self->base.rel, self->base.max_dup_errors);
 
 	self->base.desc = RelationGetDescr(self->base.rel);
 
+#if PG_VERSION_NUM >= 100000
+	if (self->base.rel->rd_rel->relkind == RELKIND_PARTITIONED_TABLE)
+		self->partition = true;
+#endif
+	if (self->partition)
+		open_routes(self);
+
+	/*
+	 * A partitioned table has no storage.  An inheritance parent keeps the
+	 * tuples which no child table accepts.
+	 */
+	if (self->base.rel->rd_rel->relkind == RELKIND_RELATION)
+		open_target(self);
+	else
+		self->base.context = GetPerTupleMemoryContext(self->route_estate);
+
+	self->base.tchecker = CreateTupleChecker(self->base.desc);
+	self->base.tchecker->checker = (CheckerTupleProc) CoercionCheckerTuple;
+
+	/* Let the parser form tuples directly in our pages */
+	if (!self->partition)
+	{
+		self->base.reserve = (WriterReserveProc) DirectWriterReserve;
+		self->base.confirm = (WriterConfirmProc) DirectWriterConfirm;
+		self->base.cancel = (WriterCancelProc) DirectWriterCancel;
+	}
+
+	/* Write TOAST chunks directly with another writer for the TOAST table */
+	if (OidIsValid(self->base.rel->rd_rel->reltoastrelid))
+		self->toast = create_toast_writer(self);
+
+	/* Values are compressed only in toast_tuple() */
+	if (self->toast && self->compress_threads > 1 && !self->partition)
+		start_compress_threads(self);
+}
+
+/**
+ * @brief Prepare the arenas, the load status file and the index spooler
+ * for the target relation opened in self->base.rel.
+ */
+static void
+open_target(DirectWriter *self)
+{
+	LoadStatus		   *ls;
+	int					i;
+
 	SpoolerOpen(&self->spooler, self->base.rel, false, self->base.on_duplicate,
-				self->base.max_dup_errors, self->base.dup_badfile);
+				self->base.max_dup_errors, self->base.dup_badfile,
+				self->base.index_update);
 	self->base.context = GetPerTupleMemoryContext(self->spooler.estate);
 
 	/* Verify DataDir/pg_bulkload directory */
 	ValidateLSFDirectory(BULKLOAD_LSF_DIR);
 
+	/* Allocate block arenas and fill the first one */
+	self->arenas = palloc0(self->narenas * sizeof(BlockArena));
+	for (i = 0; i < self->narenas; i++)
+		self->arenas[i].blocks = palloc(BLCKSZ * self->nblocks);
+	self->curarena = 0;
+	self->blocks = self->arenas[0].blocks;
+
 	/* Initialize first block */
 	PageInit(GetCurrentPage(self), BLCKSZ, 0);
 	PageSetTLI(GetCurrentPage(self), ThisTimeLineID);
@@ -190,6 +493,41 @@ DirectWriterInit(DirectWriter *self)
 	ls->ls.exist_cnt = RelationGetNumberOfBlocks(self->base.rel);
 	ls->ls.create_cnt = 0;
 
+	/*
+	 * Frozen tuples are visible to all transactions once committed, so they
+	 * are allowed only in a relfilenode created by this transaction, as
+	 * COPY FREEZE does.  The relation must be empty to build its visibility
+	 * map from scratch.
+	 */
+	if (self->freeze)
+	{
+		if (self->base.rel->rd_createSubid == InvalidSubTransactionId &&
+			self->base.rel->rd_newRelfilenodeSubid == InvalidSubTransactionId)
+			ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot use FREEZE because the table was not created or truncated in the current transaction"),
+				 errhint("Use TRUNCATE = YES.")));
+		if (ls->ls.exist_cnt > 0)
+			ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot use FREEZE because the table is not empty"),
+				 errhint("Use TRUNCATE = YES.")));
+
+		self->vmpage = palloc(BLCKSZ);
+		PageInit(self->vmpage, BLCKSZ, 0);
+		self->vmblk = 0;
+	}
+
+	/*
+	 * An empty relfilenode created in this transaction, ex. by TRUNCATE, is
+	 * not referred to by the catalog until the transaction commits, so the
+	 * loaded blocks never become visible after a crash.  We need no load
+	 * status file for it.
+	 */
+	self->fresh = (ls->ls.exist_cnt == 0 &&
+		(self->base.rel->rd_createSubid != InvalidSubTransactionId ||
+		 self->base.rel->rd_newRelfilenodeSubid != InvalidSubTransactionId));
+
 	/*
 	 * Create a load status file and write the initial status for it.
 	 * At the time, if we find any existing load status files, exit with
@@ -197,22 +535,32 @@ DirectWriterInit(DirectWriter *self)
 	 * load to the same table.
 	 */
 	BULKLOAD_LSF_PATH(self->lsf_path, ls);
-	self->lsf_fd = BasicOpenFile(self->lsf_path,
-		O_CREAT | O_EXCL | O_RDWR | PG_BINARY, S_IRUSR | S_IWUSR);
-	if (self->lsf_fd == -1)
-		ereport(ERROR, (errcode_for_file_access(),
-			errmsg("could not create loadstatus file \"%s\": %m", self->lsf_path)));
-
-	if (write(self->lsf_fd, ls, sizeof(LoadStatus)) != sizeof(LoadStatus) ||
-		pg_fsync(self->lsf_fd) != 0)
+	if (!self->fresh)
 	{
-		UnlinkLSF(self);
-		ereport(ERROR, (errcode_for_file_access(),
-			errmsg("could not write loadstatus file \"%s\": %m", self->lsf_path)));
+		self->lsf_fd = BasicOpenFile(self->lsf_path,
+			O_CREAT | O_EXCL | O_RDWR | PG_BINARY, S_IRUSR | S_IWUSR);
+		if (self->lsf_fd == -1)
+			ereport(ERROR, (errcode_for_file_access(),
+				errmsg("could not create loadstatus file \"%s\": %m", self->lsf_path)));
+
+		if (write(self->lsf_fd, ls, sizeof(LoadStatus)) != sizeof(LoadStatus) ||
+			pg_fsync(self->lsf_fd) != 0)
+		{
+			UnlinkLSF(self);
+			ereport(ERROR, (errcode_for_file_access(),
+				errmsg("could not write loadstatus file \"%s\": %m", self->lsf_path)));
+		}
 	}
 
-	self->base.tchecker = CreateTupleChecker(self->base.desc);
-	self->base.tchecker->checker = (CheckerTupleProc) CoercionCheckerTuple;
+	/* Start the flush thread */
+	if (self->narenas > 1)
+	{
+		pthread_mutex_init(&self->flush_lock, NULL);
+		pthread_cond_init(&self->flush_cond, NULL);
+		if (pthread_create(&self->flush_th, NULL, FlushThreadMain, self) != 0)
+			elog(ERROR, "pthread_create");
+		self->flush_started = true;
+	}
 }
 
 /**
@@ -221,6 +569,91 @@ DirectWriterInit(DirectWriter *self)
  */
 static void
 DirectWriterInsert(DirectWriter *self, HeapTuple tuple)
+{
+	insert_tuple(self, tuple, NULL, 0);
+}
+
+/**
+ * @brief Load a batch of heap tuples.  With compression threads, values
+ * to be compressed in the batch are compressed ahead of the insertions.
+ */
+static void
+DirectWriterInsertBatch(DirectWriter *self, HeapTuple *tuples, int ntuples)
+{
+	int				natts = self->base.desc->natts;
+	CompressJob	   *jobs;
+	int			   *first;
+	Datum		   *values;
+	bool		   *isnull;
+	int				njobs = 0;
+	int				maxjobs = 0;
+	int				i;
+
+	if (self->routes)
+	{
+		for (i = 0; i < ntuples; i++)
+			insert_tuple(self, tuples[i], NULL, 0);
+
+		/* The caller resets only our context. */
+		ResetPerTupleExprContext(self->route_estate);
+		for (i = 0; i < self->nroutes; i++)
+		{
+			if (self->routes[i].writer)
+				MemoryContextReset(self->routes[i].writer->base.context);
+		}
+		return;
+	}
+
+	if (self->compress == NULL)
+	{
+		for (i = 0; i < ntuples; i++)
+			insert_tuple(self, tuples[i], NULL, 0);
+		return;
+	}
+
+	/* Plan the jobs for all tuples first, because threads refer to them. */
+	for (i = 0; i < ntuples; i++)
+	{
+		if (tuples[i]->t_len > TOAST_TUPLE_THRESHOLD)
+			maxjobs += natts;
+	}
+	if (maxjobs == 0)
+	{
+		for (i = 0; i < ntuples; i++)
+			insert_tuple(self, tuples[i], NULL, 0);
+		return;
+	}
+
+	jobs = palloc(maxjobs * sizeof(CompressJob));
+	first = palloc((ntuples + 1) * sizeof(int));
+	values = palloc(natts * sizeof(Datum));
+	isnull = palloc(natts * sizeof(bool));
+	for (i = 0; i < ntuples; i++)
+	{
+		first[i] = njobs;
+		if (tuples[i]->t_len > TOAST_TUPLE_THRESHOLD)
+			njobs += plan_compress_jobs(self, tuples[i], jobs + njobs,
+										values, isnull);
+	}
+	first[ntuples] = njobs;
+
+	submit_compress_jobs(self->compress, jobs, njobs);
+	for (i = 0; i < ntuples; i++)
+		insert_tuple(self, tuples[i], jobs + first[i], first[i + 1] - first[i]);
+	finish_compress_jobs(self->compress);
+
+	pfree(jobs);
+	pfree(first);
+	pfree(values);
+	pfree(isnull);
+}
+
+/**
+ * @brief Load a heap tuple.  Compression of its values might have been
+ * submitted to compression threads as jobs.
+ */
+static void
+insert_tuple(DirectWriter *self, HeapTuple tuple, CompressJob *jobs, int njobs)
 {
 	Page			page;
 	OffsetNumber	offnum;
@@ -228,9 +661,37 @@ DirectWriterInsert(DirectWriter *self, HeapTuple tuple)
 	Item			item;
 	LoadStatus	   *ls = &self->ls;
 
+	/* Tuples formed in place have been written by DirectWriterConfirm. */
+	if (is_reserved_tuple(self, tuple))
+		return;
+
+	/* Route the tuple to a child table. */
+	if (self->routes)
+	{
+		PartRoute  *route = route_tuple(self, &tuple);
+
+		if (route != NULL)
+		{
+			if (route->writer == NULL)
+				route->writer = create_part_writer(self, route->rel);
+			insert_tuple(route->writer, tuple, NULL, 0);
+			return;
+		}
+		if (self->arenas == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_CHECK_VIOLATION),
+					 errmsg("no partition of relation \"%s\" found for row",
+							RelationGetRelationName(self->base.rel))));
+	}
+
 	/* Compress the tuple data if needed. */
 	if (tuple->t_len > TOAST_TUPLE_THRESHOLD)
-		tuple = toast_insert_or_update(self->base.rel, tuple, NULL, 0);
+	{
+		if (self->toast)
+			tuple = toast_tuple(self, tuple, jobs, njobs);
+		else
+			tuple = toast_insert_or_update(self->base.rel, tuple, NULL, 0);
+	}
 	BULKLOAD_PROFILE(&prof_writer_toast);
 
 	/* Assign oids if needed. */
@@ -248,47 +709,974 @@ DirectWriterInsert(DirectWriter *self, HeapTuple tuple)
 						(unsigned long) tuple->t_len,
 						(unsigned long) MaxHeapTupleSize)));
 
-	/* Fill current page, or go to next page if the page is full. */
+	page = get_insert_page(self, tuple->t_len);
+	set_tuple_header(self, tuple->t_data);
+
+	/* put the tuple on local page. */
+	offnum = PageAddItem(page, (Item) tuple->t_data,
+		tuple->t_len, InvalidOffsetNumber, false, true);
+
+	ItemPointerSet(&(tuple->t_self), LS_TOTAL_CNT(ls) + self->curblk, offnum);
+	itemId = PageGetItemId(page, offnum);
+	item = PageGetItem(page, itemId);
+	((HeapTupleHeader) item)->t_ctid = tuple->t_self;
+
+	BULKLOAD_PROFILE(&prof_writer_table);
+	SpoolerInsert(&self->spooler, tuple);
+	BULKLOAD_PROFILE(&prof_writer_index);
+}
+
+/**
+ * @brief Get the page to put a tuple of len bytes on.  Fill current page,
+ * or go to next page if the page is full.
+ */
+static Page
+get_insert_page(DirectWriter *self, Size len)
+{
+	Page	page;
+
 	page = GetCurrentPage(self);
-	if (PageGetFreeSpace(page) < MAXALIGN(tuple->t_len) +
+	if (PageGetFreeSpace(page) < MAXALIGN(len) +
 		RelationGetTargetPageFreeSpace(self->base.rel, HEAP_DEFAULT_FILLFACTOR))
 	{
+		if (self->curblk < self->nblocks - 1)
+			self->curblk++;
+		else
+		{
+			flush_pages(self);
+			next_arena(self);	/* recycle from first block */
+		}
+
+		page = GetCurrentPage(self);
+
+		/* Initialize current block */
+		PageInit(page, BLCKSZ, 0);
+		PageSetTLI(page, ThisTimeLineID);
+	}
+
+	return page;
+}
+
+/**
+ * @brief Set the transaction fields of a tuple header.
+ */
+static void
+set_tuple_header(DirectWriter *self, HeapTupleHeader td)
+{
+	td->t_infomask &= ~(HEAP_XACT_MASK);
+	td->t_infomask2 &= ~(HEAP2_XACT_MASK);
+	td->t_infomask |= HEAP_XMAX_INVALID;
+	if (self->freeze)
+	{
+#if PG_VERSION_NUM >= 90400
+		HeapTupleHeaderSetXmin(td, self->xid);
+		HeapTupleHeaderSetXminFrozen(td);
+#else
+		td->t_infomask |= HEAP_XMIN_COMMITTED;
+		HeapTupleHeaderSetXmin(td, FrozenTransactionId);
+#endif
+	}
+	else
+		HeapTupleHeaderSetXmin(td, self->xid);
+	HeapTupleHeaderSetCmin(td, self->cid);
+	HeapTupleHeaderSetXmax(td, 0);
+}
+
+/**
+ * @brief Reserve space for a tuple on the current page, where the parser
+ * forms the tuple.  Tuples to be toasted are formed as usual.
+ */
+static HeapTuple
+DirectWriterReserve(DirectWriter *self, Size len)
+{
+	Page			page;
+	PageHeader		phdr;
+	OffsetNumber	offnum;
+	ItemId			itemId;
+	HeapTuple		tuple;
+
+	Assert(self->reserved == NULL);
+
+	if (len > TOAST_TUPLE_THRESHOLD)
+		return NULL;
+
+	/* Same as PageAddItem, but leave the zeroed space to the parser. */
+	page = get_insert_page(self, len);
+	phdr = (PageHeader) page;
+	offnum = OffsetNumberNext(PageGetMaxOffsetNumber(page));
+	itemId = PageGetItemId(page, offnum);
+	phdr->pd_lower += sizeof(ItemIdData);
+	phdr->pd_upper -= MAXALIGN(len);
+	ItemIdSetNormal(itemId, phdr->pd_upper, len);
+
+	tuple = palloc(sizeof(HeapTupleData));
+	tuple->t_len = len;
+	ItemPointerSet(&tuple->t_self, LS_TOTAL_CNT(&self->ls) + self->curblk,
+				   offnum);
+	tuple->t_tableOid = InvalidOid;
+	tuple->t_data = (HeapTupleHeader) PageGetItem(page, itemId);
+	self->reserved = tuple;
+
+	return tuple;
+}
+
+/**
+ * @brief Write the reserved tuple after it passed the checker.
+ */
+static void
+DirectWriterConfirm(DirectWriter *self, HeapTuple tuple)
+{
+	if (self->reserved == NULL)
+		return;
+
+	/* The checker formed another tuple, which is inserted as usual. */
+	if (tuple != self->reserved)
+	{
+		DirectWriterCancel(self);
+		return;
+	}
+	self->reserved = NULL;
+
+	/* Assign oids if needed. */
+	if (self->base.rel->rd_rel->relhasoids)
+		HeapTupleSetOid(tuple, GetNewOid(self->base.rel));
+
+	set_tuple_header(self, tuple->t_data);
+	tuple->t_data->t_ctid = tuple->t_self;
+
+	/*
+	 * Spool it now, because the page might be flushed and recycled before
+	 * the tuple is passed to DirectWriterInsert.
+	 */
+	SpoolerInsert(&self->spooler, tuple);
+}
+
+/**
+ * @brief Release the space of the reserved tuple.  It is always the last
+ * item on the current page.
+ */
+static void
+DirectWriterCancel(DirectWriter *self)
+{
+	HeapTuple	tuple = self->reserved;
+	Page		page;
+	PageHeader	phdr;
+
+	if (tuple == NULL)
+		return;
+
+	page = GetCurrentPage(self);
+	phdr = (PageHeader) page;
+	Assert(ItemPointerGetOffsetNumber(&tuple->t_self) ==
+		   PageGetMaxOffsetNumber(page));
+
+	MemSet(tuple->t_data, 0, MAXALIGN(tuple->t_len));
+	MemSet(PageGetItemId(page, PageGetMaxOffsetNumber(page)), 0,
+		   sizeof(ItemIdData));
+	phdr->pd_upper += MAXALIGN(tuple->t_len);
+	phdr->pd_lower -= sizeof(ItemIdData);
+
+	pfree(tuple);
+	self->reserved = NULL;
+}
+
+/**
+ * @brief Is the tuple formed in place?  Its data is in one of the arenas,
+ * which might have been recycled already, so it must not be read.
+ */
+static bool
+is_reserved_tuple(DirectWriter *self, HeapTuple tuple)
+{
+	char   *data = (char *) tuple->t_data;
+	int		i;
+
+	if (self->base.reserve == NULL)
+		return false;
+
+	for (i = 0; i < self->narenas; i++)
+	{
+		char   *blocks = self->arenas[i].blocks;
+
+		if (data >= blocks && data < blocks + BLCKSZ * self->nblocks)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Create a DirectWriter for the TOAST table of the parent's target.
+ */
+static DirectWriter *
+create_toast_writer(DirectWriter *parent)
+{
+	DirectWriter   *self;
+
+	self = (DirectWriter *) CreateDirectWriter(NULL);
+	self->base.relid = parent->base.rel->rd_rel->reltoastrelid;
+	self->base.max_dup_errors = 0;
+	self->base.dup_badfile = parent->base.dup_badfile;
+	self->narenas = parent->narenas;
+	self->nblocks = parent->nblocks;
+	self->lsf_reserve = parent->lsf_reserve;
+	self->freeze = parent->freeze;
+
+	self->base.rel = heap_open(self->base.relid, AccessExclusiveLock);
+	self->base.desc = RelationGetDescr(self->base.rel);
+	open_target(self);
+
+	return self;
+}
+
+/**
+ * @brief Open the child tables of the target to route tuples to them.
+ *
+ * Tuples are routed by the partition constraints of partitions, or by the
+ * CHECK constraints of inheritance children, which must have some.  The
+ * routes are sorted by OID so that a row accepted by several inheritance
+ * children always goes to the same one.  The writers for them are created
+ * when the first tuple is routed.
+ */
+static void
+open_routes(DirectWriter *self)
+{
+#if PG_VERSION_NUM >= 90000
+	Relation	parent = self->base.rel;
+	List	   *children;
+	ListCell   *cell;
+
+	self->route_estate = CreateExecutorState();
+
+	children = find_all_inheritors(RelationGetRelid(parent),
+								   AccessExclusiveLock, NULL);
+	self->routes = palloc0(list_length(children) * sizeof(PartRoute));
+	self->disjoint = true;
+	foreach(cell, children)
+	{
+		Relation	rel;
+		PartRoute  *route;
+		List	   *quals = NIL;
+
+		if (lfirst_oid(cell) == RelationGetRelid(parent))
+			continue;
+
+		/* Skip partitioned tables in the middle, and foreign tables. */
+		rel = heap_open(lfirst_oid(cell), NoLock);
+		if (rel->rd_rel->relkind != RELKIND_RELATION)
+		{
+			heap_close(rel, NoLock);
+			continue;
+		}
+
+#if PG_VERSION_NUM >= 100000
+		if (rel->rd_rel->relispartition)
+			quals = list_copy(RelationGetPartitionQual(rel));
+		else
+#endif
+		{
+			TupleConstr	   *constr = RelationGetDescr(rel)->constr;
+			int				i;
+
+			/* A child without CHECK constraints would accept every row. */
+			if (constr == NULL || constr->num_check == 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("child table \"%s\" has no CHECK constraints to route rows",
+								RelationGetRelationName(rel)),
+						 errhint("Add CHECK constraints to the child tables, or use PARTITION = NO.")));
+
+			for (i = 0; i < constr->num_check; i++)
+				quals = list_concat(quals, make_ands_implicit(
+							(Expr *) stringToNode(constr->check[i].ccbin)));
+			self->disjoint = false;
+		}
+
+		route = &self->routes[self->nroutes++];
+		route->rel = rel;
+		route->map = convert_tuples_by_name(RelationGetDescr(parent),
+											RelationGetDescr(rel),
+							gettext_noop("could not convert row type"));
+		route->slot = MakeSingleTupleTableSlot(RelationGetDescr(rel));
+#if PG_VERSION_NUM >= 100000
+		route->qual = ExecPrepareCheck(quals, self->route_estate);
+#else
+		route->qual = (List *) ExecPrepareExpr((Expr *) quals,
+											   self->route_estate);
+#endif
+	}
+	list_free(children);
+
+	if (self->nroutes == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("table \"%s\" has no child tables to load",
+						RelationGetRelationName(parent))));
+
+	qsort(self->routes, self->nroutes, sizeof(PartRoute), compare_routes);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("PARTITION requires PostgreSQL 9.0 or later")));
+#endif
+}
+
+static int
+compare_routes(const void *a, const void *b)
+{
+	Oid		oid1 = RelationGetRelid(((const PartRoute *) a)->rel);
+	Oid		oid2 = RelationGetRelid(((const PartRoute *) b)->rel);
+
+	if (oid1 < oid2)
+		return -1;
+	else if (oid1 > oid2)
+		return 1;
+	return 0;
+}
+
+/**
+ * @brief Find the child table for a tuple.  Rows in a file are often
+ * grouped by partitions, so the last partition is tried first.  CHECK
+ * constraints of inheritance children may overlap, so they are tried in OID
+ * order and the first child that accepts the tuple is taken.
+ *
+ * @param tuple [in/out] Tuple, converted to the rowtype of the child table.
+ * @return The route to the child table, or NULL if no child accepts it.
+ */
+static PartRoute *
+route_tuple(DirectWriter *self, HeapTuple *tuple)
+{
+	ExprContext	   *econtext = GetPerTupleExprContext(self->route_estate);
+	int				start = (self->disjoint ? self->lastroute : 0);
+	int				n;
+
+	for (n = 0; n < self->nroutes; n++)
+	{
+		int			i = (start + n) % self->nroutes;
+		PartRoute  *route = &self->routes[i];
+		HeapTuple	converted = *tuple;
+		bool		accepted;
+
+		if (route->map)
+			converted = do_convert_tuple(converted, route->map);
+		ExecStoreTuple(converted, route->slot, InvalidBuffer, false);
+		econtext->ecxt_scantuple = route->slot;
+
+		/* NULL results are accepted, same as CHECK constraints. */
+#if PG_VERSION_NUM >= 100000
+		accepted = ExecCheck(route->qual, econtext);
+#else
+		accepted = ExecQual(route->qual, econtext, true);
+#endif
+		if (accepted)
+		{
+			self->lastroute = i;
+			*tuple = converted;
+			return route;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Create a DirectWriter for a child table of the parent's target.
+ */
+static DirectWriter *
+create_part_writer(DirectWriter *parent, Relation rel)
+{
+	DirectWriter   *self;
+
+	self = (DirectWriter *) CreateDirectWriter(NULL);
+	self->base.relid = RelationGetRelid(rel);
+	self->base.on_duplicate = parent->base.on_duplicate;
+	self->base.index_update = parent->base.index_update;
+	self->base.max_dup_errors = parent->base.max_dup_errors;
+	self->base.dup_badfile = parent->base.dup_badfile;
+	self->narenas = parent->narenas;
+	self->nblocks = parent->nblocks;
+	self->lsf_reserve = parent->lsf_reserve;
+	self->freeze = parent->freeze;
+
+	self->base.rel = heap_open(self->base.relid, AccessExclusiveLock);
+	VerifyTarget(self->base.rel, self->base.max_dup_errors);
+	self->base.desc = RelationGetDescr(self->base.rel);
+	open_target(self);
+
+	if (OidIsValid(self->base.rel->rd_rel->reltoastrelid))
+		self->toast = create_toast_writer(self);
+
+	return self;
+}
+
+/**
+ * @brief Close the writers for the child tables, which merge their own
+ * indexes.  Duplicates are appended to the same DUPLICATE_BADFILE.
+ */
+static void
+close_routes(DirectWriter *self, bool onError, WriterResult *ret)
+{
+	bool	dup_append = false;
+	int		i;
+
+	for (i = 0; i < self->nroutes; i++)
+	{
+		PartRoute  *route = &self->routes[i];
+
+		if (route->writer)
+		{
+			WriterResult	r;
+
+			route->writer->spooler.dup_append = dup_append;
+			r = DirectWriterClose(route->writer, onError);
+			route->writer = NULL;
+
+			ret->num_dup_new += r.num_dup_new;
+			ret->num_dup_old += r.num_dup_old;
+			if (r.num_dup_new + r.num_dup_old > 0)
+				dup_append = true;
+		}
+
+		if (!onError)
+		{
+			ExecDropSingleTupleTableSlot(route->slot);
+			heap_close(route->rel, NoLock);
+		}
+	}
+	self->spooler.dup_append = dup_append;
+
+	if (!onError)
+	{
+		FreeExecutorState(self->route_estate);
+		pfree(self->routes);
+	}
+	self->routes = NULL;
+}
+
+/**
+ * @brief Toast a tuple, writing external values with the TOAST writer.
+ *
+ * Follows toast_insert_or_update() for a new tuple: compress and move out
+ * the largest EXTENDED and EXTERNAL attributes first, then MAIN ones, until
+ * the tuple fits in TOAST_TUPLE_TARGET.
+ */
+static HeapTuple
+toast_tuple(DirectWriter *self, HeapTuple tuple, CompressJob *jobs, int njobs)
+{
+	TupleDesc			desc = self->base.desc;
+	Form_pg_attribute  *attrs = desc->attrs;
+	int					natts = desc->natts;
+	Datum			   *values;
+	bool			   *isnull;
+	Size			   *sizes;
+	char			   *action;	/* ' ' to toast, 'x' incompressible, 'p' done */
+	bool				changed = false;
+	Size				maxDataLen;
+	int					pass;
+	int					i;
+	HeapTuple			result;
+
+	values = palloc(natts * sizeof(Datum));
+	isnull = palloc(natts * sizeof(bool));
+	sizes = palloc(natts * sizeof(Size));
+	action = palloc(natts * sizeof(char));
+
+	heap_deform_tuple(tuple, desc, values, isnull);
+
+	for (i = 0; i < natts; i++)
+	{
+		struct varlena *value;
+
+		action[i] = ' ';
+		if (isnull[i])
+		{
+			action[i] = 'p';
+			continue;
+		}
+		if (attrs[i]->attlen != -1)
+		{
+			action[i] = 'p';
+			continue;
+		}
+		if (attrs[i]->attstorage == 'p')
+			action[i] = 'p';
+
+		/*
+		 * Values from filter functions might be toasted already.  Fetch them,
+		 * because the TOAST table cannot be shared with heap_insert.
+		 */
+		value = (struct varlena *) DatumGetPointer(values[i]);
+		if (VARATT_IS_EXTERNAL(value))
+		{
+			if (attrs[i]->attstorage == 'p')
+				value = heap_tuple_untoast_attr(value);
+			else
+				value = heap_tuple_fetch_attr(value);
+			values[i] = PointerGetDatum(value);
+			changed = true;
+		}
+		sizes[i] = VARSIZE_ANY(value);
+	}
+
+	maxDataLen = toast_max_data_len(desc, isnull);
+
+	/*
+	 * Pass 0 and 1 handle EXTENDED and EXTERNAL attributes, pass 2 and 3
+	 * handle MAIN attributes.  Even passes compress values, and odd passes
+	 * move them to the TOAST table.
+	 */
+	for (pass = 0; pass < 4; pass++)
+	{
+		bool	compress = (pass % 2 == 0);
+
+		while (heap_compute_data_size(desc, values, isnull) > maxDataLen)
+		{
+			int		biggest_attno = -1;
+			Size	biggest_size = MAXALIGN(TOAST_POINTER_SIZE);
+
+			for (i = 0; i < natts; i++)
+			{
+				struct varlena *value =
+					(struct varlena *) DatumGetPointer(values[i]);
+
+				if (action[i] == 'p' || (compress && action[i] != ' '))
+					continue;
+				if (VARATT_IS_EXTERNAL(value))
+					continue;
+				if (compress && VARATT_IS_COMPRESSED(value))
+					continue;
+				if (pass < 2 ? (attrs[i]->attstorage != 'x' &&
+								attrs[i]->attstorage != 'e')
+							 : attrs[i]->attstorage != 'm')
+					continue;
+				if (sizes[i] > biggest_size)
+				{
+					biggest_attno = i;
+					biggest_size = sizes[i];
+				}
+			}
+			if (biggest_attno < 0)
+				break;
+			i = biggest_attno;
+
+			if (compress && attrs[i]->attstorage != 'e')
+			{
+				Datum	value = compress_datum(self, values[i], i, jobs, njobs);
+
+				if (DatumGetPointer(value) != NULL)
+				{
+					values[i] = value;
+					sizes[i] = VARSIZE(DatumGetPointer(value));
+					changed = true;
+				}
+				else
+					action[i] = 'x';	/* incompressible */
+			}
+			else if (compress)
+				action[i] = 'x';		/* EXTERNAL is not compressed */
+
+			/*
+			 * Move the value out if it is too large by itself, or if we are
+			 * in the passes to move values.
+			 */
+			if (!compress || (pass == 0 && sizes[i] > maxDataLen))
+			{
+				values[i] = save_toast_datum(self, values[i]);
+				sizes[i] = TOAST_POINTER_SIZE;
+				action[i] = 'p';
+				changed = true;
+			}
+		}
+	}
+
+	if (changed)
+	{
+		result = heap_form_tuple(desc, values, isnull);
+		result->t_self = tuple->t_self;
+	}
+	else
+		result = tuple;
+
+	pfree(values);
+	pfree(isnull);
+	pfree(sizes);
+	pfree(action);
+
+	return result;
+}
+
+/**
+ * @brief Max size of the data part of a toasted tuple.
+ */
+static Size
+toast_max_data_len(TupleDesc desc, bool *isnull)
+{
+	Size	hoff;
+	int		i;
+
+	hoff = offsetof(HeapTupleHeaderData, t_bits);
+	for (i = 0; i < desc->natts; i++)
+	{
+		if (isnull[i])
+		{
+			hoff += BITMAPLEN(desc->natts);
+			break;
+		}
+	}
+	if (desc->tdhasoid)
+		hoff += sizeof(Oid);
+	hoff = MAXALIGN(hoff);
+
+	return TOAST_TUPLE_TARGET - hoff;
+}
+
+/**
+ * @brief Plan compression jobs for a tuple to be toasted.
+ *
+ * toast_tuple() compresses the largest EXTENDED values first until the
+ * tuple fits.  Even if they were compressed to nothing, it would compress
+ * the values chosen here, so the jobs are never wasted.  Other values are
+ * compressed by toast_tuple() itself if needed.
+ *
+ * @return Number of jobs stored in jobs.
+ */
+static int
+plan_compress_jobs(DirectWriter *self, HeapTuple tuple, CompressJob *jobs,
+				   Datum *values, bool *isnull)
+{
+	TupleDesc			desc = self->base.desc;
+	Form_pg_attribute  *attrs = desc->attrs;
+	Size				datalen;
+	Size				maxDataLen;
+	int					njobs = 0;
+	int					i;
+
+	heap_deform_tuple(tuple, desc, values, isnull);
+	datalen = heap_compute_data_size(desc, values, isnull);
+	maxDataLen = toast_max_data_len(desc, isnull);
+
+	while (datalen > maxDataLen)
+	{
+		int		biggest_attno = -1;
+		Size	biggest_size = MAXALIGN(TOAST_POINTER_SIZE);
+		int		j;
+
+		for (i = 0; i < desc->natts; i++)
+		{
+			struct varlena *value =
+				(struct varlena *) DatumGetPointer(values[i]);
+
+			if (isnull[i] || attrs[i]->attlen != -1 ||
+				attrs[i]->attstorage != 'x')
+				continue;
+			if (VARATT_IS_EXTERNAL(value) || VARATT_IS_COMPRESSED(value))
+				continue;
+			if (VARSIZE_ANY(value) <= biggest_size)
+				continue;
+			for (j = 0; j < njobs; j++)
+			{
+				if (jobs[j].attnum == i)
+					break;
+			}
+			if (j < njobs)
+				continue;
+
+			biggest_attno = i;
+			biggest_size = VARSIZE_ANY(value);
+		}
+		if (biggest_attno < 0)
+			break;
+
+		jobs[njobs].attnum = biggest_attno;
+		jobs[njobs].source = VARDATA_ANY(DatumGetPointer(values[biggest_attno]));
+		jobs[njobs].slen = VARSIZE_ANY_EXHDR(DatumGetPointer(values[biggest_attno]));
+		jobs[njobs].dest = palloc(COMPRESS_BUFSIZE(jobs[njobs].slen));
+		jobs[njobs].state = JOB_WAITING;
+		jobs[njobs].compressed = false;
+		njobs++;
+
+		datalen -= Min(datalen, biggest_size);
+	}
+
+	return njobs;
+}
+
+/**
+ * @brief Compress a value, or take the result of its compression job.
+ */
+static Datum
+compress_datum(DirectWriter *self, Datum value, int attnum,
+			   CompressJob *jobs, int njobs)
+{
+	int		i;
+
+	for (i = 0; i < njobs; i++)
+	{
+		if (jobs[i].attnum == attnum)
+		{
+			wait_compress_job(self->compress, &jobs[i]);
+			if (!jobs[i].compressed)
+				return PointerGetDatum(NULL);
+			return PointerGetDatum(jobs[i].dest);
+		}
+	}
+
+	return toast_compress_datum(value);
+}
+
+static void
+start_compress_threads(DirectWriter *self)
+{
+	CompressPool   *pool = palloc0(sizeof(CompressPool));
+	int				i;
+
+	pool->ws = palloc(sizeof(PGLZWorkspace));
+	pool->th = palloc0(sizeof(pthread_t) * self->compress_threads);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	self->compress = pool;
+
+	for (i = 0; i < self->compress_threads; i++)
+	{
+		if (pthread_create(&pool->th[i], NULL, CompressThreadMain, pool) != 0)
+			elog(ERROR, "pthread_create");
+		pool->nthreads++;
+	}
+}
+
+static void
+stop_compress_threads(DirectWriter *self)
+{
+	CompressPool   *pool = self->compress;
+	int				i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->th[i], NULL);
+
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+
+	pfree(pool->ws);
+	pfree(pool->th);
+	pfree(pool);
+	self->compress = NULL;
+}
+
+static void
+submit_compress_jobs(CompressPool *pool, CompressJob *jobs, int njobs)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->jobs = jobs;
+	pool->njobs = njobs;
+	pool->next = 0;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Wait for a job to be done, or run it if no threads claimed it.
+ */
+static void
+wait_compress_job(CompressPool *pool, CompressJob *job)
+{
+	pthread_mutex_lock(&pool->lock);
+	if (job->state == JOB_WAITING)
+	{
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
+
+		job->compressed = CompressValue(job->source, job->slen, job->dest,
+										pool->ws);
+
+		pthread_mutex_lock(&pool->lock);
+		job->state = JOB_DONE;
+	}
+	while (job->state != JOB_DONE)
+	{
+		WaitForThread(&pool->done, &pool->lock);
+
+		pthread_mutex_unlock(&pool->lock);
+		CHECK_FOR_INTERRUPTS();
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Cancel unclaimed jobs of the batch and wait for running ones,
+ * because their buffers are released with the batch.
+ */
+static void
+finish_compress_jobs(CompressPool *pool)
+{
+	int		i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < pool->njobs; i++)
+	{
+		if (pool->jobs[i].state == JOB_WAITING)
+			pool->jobs[i].state = JOB_DONE;
+	}
+	for (i = 0; i < pool->njobs; i++)
+	{
+		while (pool->jobs[i].state != JOB_DONE)
+			pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pool->jobs = NULL;
+	pool->njobs = 0;
+	pool->next = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
 
-		
-		if (self->curblk < BLOCK_BUF_NUM - 1)
-			self->curblk++;
-		else
+/**
+ * @brief Main of the compression threads.  Must not call any PostgreSQL
+ * functions.
+ */
+static void *
+CompressThreadMain(void *arg)
+{
+	CompressPool   *pool = (CompressPool *) arg;
+	PGLZWorkspace  *ws;
+
+	/* without a workspace, leave the jobs to the backend */
+	ws = malloc(sizeof(PGLZWorkspace));
+	if (ws == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		CompressJob *job;
+
+		while (!pool->quit && pool->next < pool->njobs &&
+			   pool->jobs[pool->next].state != JOB_WAITING)
+			pool->next++;
+		if (pool->quit)
+			break;
+		if (pool->next >= pool->njobs)
 		{
-			flush_pages(self);
-			self->curblk = 0;	/* recycle from first block */
+			pthread_cond_wait(&pool->work, &pool->lock);
+			continue;
 		}
 
-		page = GetCurrentPage(self);
+		job = &pool->jobs[pool->next++];
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&pool->lock);
 
-		/* Initialize current block */
-		PageInit(page, BLCKSZ, 0);
-		PageSetTLI(page, ThisTimeLineID);
+		job->compressed = CompressValue(job->source, job->slen, job->dest, ws);
+
+		pthread_mutex_lock(&pool->lock);
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pool->done);
 	}
+	pthread_mutex_unlock(&pool->lock);
 
-	tuple->t_data->t_infomask &= ~(HEAP_XACT_MASK);
-	tuple->t_data->t_infomask2 &= ~(HEAP2_XACT_MASK);
-	tuple->t_data->t_infomask |= HEAP_XMAX_INVALID;
-	HeapTupleHeaderSetXmin(tuple->t_data, self->xid);
-	HeapTupleHeaderSetCmin(tuple->t_data, self->cid);
-	HeapTupleHeaderSetXmax(tuple->t_data, 0);
+	free(ws);
+	return NULL;
+}
 
-	/* put the tuple on local page. */
-	offnum = PageAddItem(page, (Item) tuple->t_data,
-		tuple->t_len, InvalidOffsetNumber, false, true);
+/**
+ * @brief Write a value to the TOAST table in chunks, and return a toast
+ * pointer to it.
+ *
+ * Copied from toast_save_datum(), except the chunks are loaded with the
+ * TOAST writer and their index entries are spooled.
+ */
+static Datum
+save_toast_datum(DirectWriter *self, Datum value)
+{
+	DirectWriter		   *toast = self->toast;
+	struct varlena		   *dval = (struct varlena *) DatumGetPointer(value);
+	struct varlena		   *result;
+	struct varatt_external	toast_pointer;
+	Relation				toastidx;
+	Datum					t_values[3];
+	bool					t_isnull[3];
+	int32					chunk_seq = 0;
+	char				   *data_p;
+	int32					data_todo;
+	struct
+	{
+		struct varlena	hdr;
+		char			data[TOAST_MAX_CHUNK_SIZE + VARHDRSZ];	/* make struct big enough */
+		int32			align_it;	/* ensure struct is aligned well enough */
+	}						chunk_data;
 
-	ItemPointerSet(&(tuple->t_self), LS_TOTAL_CNT(ls) + self->curblk, offnum);
-	itemId = PageGetItemId(page, offnum);
-	item = PageGetItem(page, itemId);
-	((HeapTupleHeader) item)->t_ctid = tuple->t_self;
+	if (VARATT_IS_SHORT(dval))
+	{
+		data_p = VARDATA_SHORT(dval);
+		data_todo = VARSIZE_SHORT(dval) - VARHDRSZ_SHORT;
+		toast_pointer.va_rawsize = data_todo + VARHDRSZ;
+		toast_pointer.va_extsize = data_todo;
+	}
+	else if (VARATT_IS_COMPRESSED(dval))
+	{
+		data_p = VARDATA(dval);
+		data_todo = VARSIZE(dval) - VARHDRSZ;
+		/* rawsize in a compressed datum is just the size of the payload */
+		toast_pointer.va_rawsize = VARRAWSIZE_4B_C(dval) + VARHDRSZ;
+		toast_pointer.va_extsize = data_todo;
+	}
+	else
+	{
+		data_p = VARDATA(dval);
+		data_todo = VARSIZE(dval) - VARHDRSZ;
+		toast_pointer.va_rawsize = VARSIZE(dval);
+		toast_pointer.va_extsize = data_todo;
+	}
 
-	BULKLOAD_PROFILE(&prof_writer_table);
-	SpoolerInsert(&self->spooler, tuple);
-	BULKLOAD_PROFILE(&prof_writer_index);
+	/*
+	 * Choose a value ID not used in the TOAST index.  IDs of the chunks
+	 * spooled in this load come from the OID counter, so they never collide
+	 * unless the counter wraps around within the load.
+	 */
+	toastidx = toast->spooler.relinfo->ri_IndexRelationDescs[0];
+	toast_pointer.va_toastrelid = toast->base.relid;
+	toast_pointer.va_valueid = GetNewOidWithIndex(toast->base.rel,
+										RelationGetRelid(toastidx), 1);
+
+	t_values[0] = ObjectIdGetDatum(toast_pointer.va_valueid);
+	t_values[2] = PointerGetDatum(&chunk_data);
+	t_isnull[0] = false;
+	t_isnull[1] = false;
+	t_isnull[2] = false;
+
+	while (data_todo > 0)
+	{
+		int32		chunk_size = Min(TOAST_MAX_CHUNK_SIZE, data_todo);
+		HeapTuple	toasttup;
+
+		t_values[1] = Int32GetDatum(chunk_seq++);
+		SET_VARSIZE(&chunk_data, chunk_size + VARHDRSZ);
+		memcpy(VARDATA(&chunk_data), data_p, chunk_size);
+		toasttup = heap_form_tuple(toast->base.desc, t_values, t_isnull);
+
+		DirectWriterInsert(toast, toasttup);
+
+		heap_freetuple(toasttup);
+		data_todo -= chunk_size;
+		data_p += chunk_size;
+	}
+
+	result = (struct varlena *) palloc(TOAST_POINTER_SIZE);
+#ifdef SET_VARTAG_EXTERNAL
+	SET_VARTAG_EXTERNAL(result, VARTAG_ONDISK);
+#else
+	SET_VARSIZE_EXTERNAL(result, TOAST_POINTER_SIZE);
+#endif
+	memcpy(VARDATA_EXTERNAL(result), &toast_pointer, sizeof(toast_pointer));
+
+	return PointerGetDatum(result);
 }
 
 /**
@@ -304,24 +1692,62 @@ DirectWriterClose(DirectWriter *self, bool onError)
 
 	Assert(self != NULL);
 
+	stop_compress_threads(self);
+
+	if (self->routes)
+		close_routes(self, onError, &ret);
+
 	/* Flush unflushed block buffer and close the heap file. */
-	if (!onError)
+	if (!onError && self->arenas)
 		flush_pages(self);
 
+	stop_flush_thread(self, onError);
+	if (!onError && self->arenas)
+	{
+		int		i;
+
+		for (i = 0; i < self->narenas; i++)
+			check_arena(&self->arenas[i]);
+	}
+
 	close_data_file(self);
+	close_vm_file(self, onError);
+
+	/*
+	 * Close the TOAST writer before merging indexes, because removing
+	 * duplicates needs the TOAST index to delete toasted values.
+	 */
+	if (self->toast)
+	{
+		DirectWriterClose(self->toast, onError);
+		self->toast = NULL;
+	}
+
 	UnlinkLSF(self);
 
 	if (!onError)
 	{
-		SpoolerClose(&self->spooler);
-		ret.num_dup_new = self->spooler.dup_new;
-		ret.num_dup_old = self->spooler.dup_old;
+		/* A partitioned table has no storage nor indexes to merge. */
+		if (self->arenas)
+		{
+			SpoolerClose(&self->spooler);
+			ret.num_dup_new += self->spooler.dup_new;
+			ret.num_dup_old += self->spooler.dup_old;
+		}
 
 		if (self->base.rel)
 			heap_close(self->base.rel, AccessExclusiveLock);
 
-		if (self->blocks)
-			pfree(self->blocks);
+		if (self->arenas)
+		{
+			int		i;
+
+			for (i = 0; i < self->narenas; i++)
+				pfree(self->arenas[i].blocks);
+			pfree(self->arenas);
+		}
+		if (self->vmpage)
+			pfree(self->vmpage);
 
 		pfree(self);
 	}
@@ -363,10 +1789,64 @@ DirectWriterParam(DirectWriter *self, const char *keyword, char *value)
 
 		self->base.on_duplicate = values[choice(keyword, value, ON_DUPLICATE_NAMES, lengthof(values))];
 	}
+	else if (CompareKeyword(keyword, "INDEX_UPDATE"))
+	{
+		const INDEX_UPDATE values[] =
+		{
+			INDEX_UPDATE_AUTO,
+			INDEX_UPDATE_REBUILD,
+			INDEX_UPDATE_INSERT
+		};
+
+		self->base.index_update = values[choice(keyword, value, INDEX_UPDATE_NAMES, lengthof(values))];
+	}
 	else if (CompareKeyword(keyword, "TRUNCATE"))
 	{
 		self->base.truncate = ParseBoolean(value);
 	}
+	else if (CompareKeyword(keyword, "FREEZE"))
+	{
+		self->freeze = ParseBoolean(value);
+	}
+	else if (CompareKeyword(keyword, "PARTITION"))
+	{
+		self->partition = ParseBoolean(value);
+	}
+	else if (CompareKeyword(keyword, "BLOCK_BUFFERS"))
+	{
+		ASSERT_ONCE(self->narenas == 0);
+		self->narenas = ParseInt32(value, 1);
+		if (self->narenas > MAX_BLOCK_BUFFERS)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("BLOCK_BUFFERS must be between 1 and %d",
+							MAX_BLOCK_BUFFERS)));
+	}
+	else if (CompareKeyword(keyword, "COMPRESS_THREADS"))
+	{
+		ASSERT_ONCE(self->compress_threads == 0);
+		self->compress_threads = ParseInt32(value, 1);
+		if (self->compress_threads > MAX_COMPRESS_THREADS)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("COMPRESS_THREADS must be between 1 and %d",
+							MAX_COMPRESS_THREADS)));
+	}
+	else if (CompareKeyword(keyword, "LSF_RESERVE"))
+	{
+		ASSERT_ONCE(self->lsf_reserve == LSF_RESERVE_UNSET);
+		self->lsf_reserve = ParseInt32(value, 0);
+	}
+	else if (CompareKeyword(keyword, "BLOCK_BUFFER_SIZE"))
+	{
+		ASSERT_ONCE(self->nblocks == 0);
+		self->nblocks = ParseInt32(value, 1);
+		if (self->nblocks > MAX_BLOCK_BUFFER_SIZE)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("BLOCK_BUFFER_SIZE must be between 1 and %d",
+							(int) MAX_BLOCK_BUFFER_SIZE)));
+	}
 	else
 		return false;	/* unknown parameter */
 
@@ -396,9 +1876,27 @@ DirectWriterDumpParams(DirectWriter *self)
 	appendStringInfo(&buf, "ON_DUPLICATE_KEEP = %s\n",
 					 ON_DUPLICATE_NAMES[self->base.on_duplicate]);
 
+	if (self->base.index_update != INDEX_UPDATE_AUTO)
+		appendStringInfo(&buf, "INDEX_UPDATE = %s\n",
+						 INDEX_UPDATE_NAMES[self->base.index_update]);
+
 	appendStringInfo(&buf, "TRUNCATE = %s\n",
 					 self->base.truncate ? "YES" : "NO");
 
+	if (self->narenas > 0 && self->narenas != DEFAULT_BLOCK_BUFFERS)
+		appendStringInfo(&buf, "BLOCK_BUFFERS = %d\n", self->narenas);
+	if (self->nblocks > 0 && self->nblocks != BLOCK_BUF_NUM)
+		appendStringInfo(&buf, "BLOCK_BUFFER_SIZE = %d\n", self->nblocks);
+	if (self->lsf_reserve > 0)
+		appendStringInfo(&buf, "LSF_RESERVE = %d\n", self->lsf_reserve);
+	if (self->freeze)
+		appendStringInfoString(&buf, "FREEZE = YES\n");
+	if (self->partition)
+		appendStringInfoString(&buf, "PARTITION = YES\n");
+	if (self->compress_threads > 1)
+		appendStringInfo(&buf, "COMPRESS_THREADS = %d\n",
+						 self->compress_threads);
+
 	LoggerLog(INFO, buf.data, 0);
 	pfree(buf.data);
 }
@@ -406,14 +1904,26 @@ DirectWriterDumpParams(DirectWriter *self)
 static int
 DirectWriterSendQuery(DirectWriter *self, PGconn *conn, char *queueName, char *logfile, bool verbose)
 {
-	const char *params[8];
+	const char *params[15];
 	char		max_dup_errors[MAXINT8LEN + 1];
+	char		narenas[MAXINT8LEN + 1];
+	char		nblocks[MAXINT8LEN + 1];
+	char		lsf_reserve[MAXINT8LEN + 1];
+	char		compress_threads[MAXINT8LEN + 1];
 
 	if (self->base.max_dup_errors < -1)
 		self->base.max_dup_errors = DEFAULT_MAX_DUP_ERRORS;
 
 	snprintf(max_dup_errors, MAXINT8LEN, INT64_FORMAT,	
 			 self->base.max_dup_errors);
+	snprintf(narenas, MAXINT8LEN, "%d",
+			 self->narenas > 0 ? self->narenas : DEFAULT_BLOCK_BUFFERS);
+	snprintf(nblocks, MAXINT8LEN, "%d",
+			 self->nblocks > 0 ? self->nblocks : BLOCK_BUF_NUM);
+	snprintf(lsf_reserve, MAXINT8LEN, "%d",
+			 self->lsf_reserve > 0 ? self->lsf_reserve : 0);
+	snprintf(compress_threads, MAXINT8LEN, "%d",
+			 self->compress_threads > 0 ? self->compress_threads : 1);
 
 	/* async query send */
 	params[0] = queueName;
@@ -424,6 +1934,13 @@ DirectWriterSendQuery(DirectWriter *self, PGconn *conn, char *queueName, char *l
 	params[5] = logfile;
 	params[6] = verbose ? "true" : "no";
 	params[7] = (self->base.truncate ? "true" : "no");
+	params[8] = narenas;
+	params[9] = nblocks;
+	params[10] = lsf_reserve;
+	params[11] = (self->freeze ? "true" : "no");
+	params[12] = compress_threads;
+	params[13] = (self->partition ? "true" : "no");
+	params[14] = INDEX_UPDATE_NAMES[self->base.index_update];
 
 	return PQsendQueryParams(conn,
 		"SELECT * FROM pg_bulkload(ARRAY["
@@ -436,8 +1953,15 @@ DirectWriterSendQuery(DirectWriter *self, PGconn *conn, char *queueName, char *l
 		"'DUPLICATE_BADFILE=' || $5,"
 		"'LOGFILE=' || $6,"
 		"'VERBOSE=' || $7,"
-		"'TRUNCATE=' || $8])",
-		8, NULL, params, NULL, NULL, 0);
+		"'TRUNCATE=' || $8,"
+		"'BLOCK_BUFFERS=' || $9,"
+		"'BLOCK_BUFFER_SIZE=' || $10,"
+		"'LSF_RESERVE=' || $11,"
+		"'FREEZE=' || $12,"
+		"'COMPRESS_THREADS=' || $13,"
+		"'PARTITION=' || $14,"
+		"'INDEX_UPDATE=' || $15])",
+		15, NULL, params, NULL, NULL, 0);
 }
 
 /**
@@ -448,9 +1972,9 @@ DirectWriterSendQuery(DirectWriter *self, PGconn *conn, char *queueName, char *l
  * <ol>
  *	 <li>If no more space is available in the data file, switch to a new one.</li>
  *	 <li>Compute block number which can be written to the current file.</li>
+ *	 <li>If there are other data, plan writes to the next file too.</li>
  *	 <li>Save the last block number in the load status file.</li>
- *	 <li>Write to the current file.</li>
- *	 <li>If there are other data, write them too.</li>
+ *	 <li>Write the current arena, or submit it to the flush thread.</li>
  * </ol>
  *
  * @param loader [in] Direct Writer.
@@ -462,6 +1986,8 @@ flush_pages(DirectWriter *loader)
 	int			i;
 	int			num;
 	LoadStatus *ls = &loader->ls;
+	BlockArena *arena = &loader->arenas[loader->curarena];
+	BlockNumber	start = LS_TOTAL_CNT(ls);
 
 	num = loader->curblk;
 	if (!PageIsEmpty(GetCurrentPage(loader)))
@@ -470,6 +1996,9 @@ flush_pages(DirectWriter *loader)
 	if (num <= 0)
 		return;		/* no work */
 
+	if (loader->freeze)
+		set_all_visible(loader, start, num);
+
 	/*
 	 * Log the first page that pg_bulkload adds to WAL to ensure the current
 	 * XID will be recorded in xlog.
@@ -494,9 +2023,13 @@ flush_pages(DirectWriter *loader)
 	 *
 	 * In order to prevent that, we arrange that the first page added by
 	 * pg_bulkload is logged to WAL.
+	 *
+	 * A fresh relfilenode does not need it, because the loaded data is never
+	 * visible unless the transaction commits.  Its XID is also recorded by
+	 * the catalog changes which created the relfilenode.
 	 */
 #if PG_VERSION_NUM >= 90100
-	if (ls->ls.create_cnt == 0 && !RELATION_IS_LOCAL(loader->base.rel)
+	if (ls->ls.create_cnt == 0 && !loader->fresh && !RELATION_IS_LOCAL(loader->base.rel)
 			&& !(loader->base.rel->rd_rel->relpersistence == RELPERSISTENCE_UNLOGGED) )
 	{
 		XLogRecPtr	recptr;
@@ -506,7 +2039,7 @@ flush_pages(DirectWriter *loader)
 		XLogFlush(recptr);
 	}
 #else
-	if (ls->ls.create_cnt == 0 && !RELATION_IS_LOCAL(loader->base.rel) )
+	if (ls->ls.create_cnt == 0 && !loader->fresh && !RELATION_IS_LOCAL(loader->base.rel) )
 	{
 		XLogRecPtr	recptr;
 
@@ -515,93 +2048,291 @@ flush_pages(DirectWriter *loader)
 		XLogFlush(recptr);
 	}
 #endif
+#if PG_VERSION_NUM >= 90300
+	arena->checksum = DataChecksumsEnabled();
+#endif
+
 	/*
-	 * Write blocks. We might need to write multiple files on boundary of
-	 * relation segments.
+	 * Plan the writes of the blocks. We might need to write multiple files on
+	 * boundary of relation segments.  Data files are opened here, and closed
+	 * by the writes after their last blocks.
 	 */
+	arena->nwrites = 0;
 	for (i = 0; i < num;)
 	{
-		char	   *buffer;
-		int			total;
-		int			written;
+		ArenaWrite *w;
 		int			flush_num;
-		BlockNumber	relblks = LS_TOTAL_CNT(ls);
+		BlockNumber	relblks = start + i;
 
 		/* Switch to the next file if the current file has been filled up. */
-		if (relblks % RELSEG_SIZE == 0)
-			close_data_file(loader);
+		if (relblks % RELSEG_SIZE == 0 && loader->datafd != -1)
+		{
+			w = &arena->writes[arena->nwrites++];
+			w->fd = loader->datafd;
+			w->first = i;
+			w->nblocks = 0;
+			w->segblk = 0;
+			w->blkno = relblks;
+			w->close = true;
+			loader->datafd = -1;
+		}
 		if (loader->datafd == -1)
 			loader->datafd = open_data_file(ls->ls.rnode,
 											RELATION_IS_LOCAL(loader->base.rel),
-											relblks);
+											MAIN_FORKNUM, relblks);
 
 		/* Number of blocks to be added to the current file. */
 		flush_num = Min(num - i, RELSEG_SIZE - relblks % RELSEG_SIZE);
 		Assert(flush_num > 0);
 
+		prealloc_data_file(loader, relblks, flush_num);
+
+		w = &arena->writes[arena->nwrites++];
+		w->fd = loader->datafd;
+		w->first = i;
+		w->nblocks = flush_num;
+		w->segblk = relblks % RELSEG_SIZE;
+		w->blkno = relblks;
+		w->close = false;
+		Assert(arena->nwrites <= MAX_ARENA_WRITES);
+
+		i += flush_num;
+	}
+
+	/*
+	 * Write the last block number to the load status file before any of the
+	 * blocks reach the data files.
+	 */
+	UpdateLSF(loader, num);
+
+	/* Write the blocks, or let the flush thread write them. */
+	if (loader->flush_started)
+	{
+		pthread_mutex_lock(&loader->flush_lock);
+		arena->submitted = true;
+		pthread_cond_broadcast(&loader->flush_cond);
+		pthread_mutex_unlock(&loader->flush_lock);
+	}
+	else
+	{
+		write_arena(arena, false);
+		check_arena(arena);
+	}
+
+	/*
+	 * NOTICE: Be sure to switch to the next arena with next_arena() if you
+	 * will continue to use blocks.
+	 */
+}
+
+/**
+ * @brief Switch to the next arena after flush_pages(), and initialize its
+ * first block.
+ */
+static void
+next_arena(DirectWriter *loader)
+{
+	BlockArena *arena;
+
+	loader->curarena = (loader->curarena + 1) % loader->narenas;
+	arena = &loader->arenas[loader->curarena];
+
+	wait_arena(loader, arena);
+	check_arena(arena);
+
+	loader->blocks = arena->blocks;
+	loader->curblk = 0;
+}
+
+/**
+ * @brief Wait for the flush thread to write the arena.
+ */
+static void
+wait_arena(DirectWriter *loader, BlockArena *arena)
+{
+	if (!loader->flush_started)
+		return;
+
+	pthread_mutex_lock(&loader->flush_lock);
+	while (arena->submitted)
+	{
+		WaitForThread(&loader->flush_cond, &loader->flush_lock);
+
+		pthread_mutex_unlock(&loader->flush_lock);
+		CHECK_FOR_INTERRUPTS();
+		pthread_mutex_lock(&loader->flush_lock);
+	}
+	pthread_mutex_unlock(&loader->flush_lock);
+}
+
+/**
+ * @brief Report an error of the last write of the arena.
+ */
+static void
+check_arena(BlockArena *arena)
+{
+	if (arena->error != 0)
+	{
+		errno = arena->error;
+		arena->error = 0;
+
+		/* fatal error, do not want to write blocks anymore */
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not write to data file: %m")));
+	}
+}
+
+/**
+ * @brief Write the blocks of the arena.
+ *
+ * Called by the flush thread, so it must not use ereport or palloc. Errors
+ * are saved in the arena and reported by check_arena.  If abort is true,
+ * data files are closed without writing blocks.
+ */
+static void
+write_arena(BlockArena *arena, bool abort)
+{
+	int		i;
+
+	for (i = 0; i < arena->nwrites; i++)
+	{
+		ArenaWrite *w = &arena->writes[i];
+		char	   *buffer = arena->blocks + (size_t) BLCKSZ * w->first;
+		size_t		total = (size_t) BLCKSZ * w->nblocks;
+		off_t		offset = (off_t) BLCKSZ * w->segblk;
+
 #if PG_VERSION_NUM >= 90300
-		if (DataChecksumsEnabled())
+		/*
+		 * Checksums are set by the flush thread, overlapped with filling the
+		 * next arena.  pg_checksum_page() comes from checksum_impl.h and does
+		 * not touch any shared state, so it is safe in the thread.
+		 */
+		if (!abort && arena->checksum)
 		{
-			Page	contained_page;
 			int		j;
 
-			/*
-			 * Write checksum for pages that are going to be written to the
-			 * current file.  We will be writing flush_num pages from the
-			 * block buffer starting at block offset i.
-			 */
-			for (j = 0; j < flush_num; j++)
+			for (j = 0; j < w->nblocks; j++)
 			{
-				contained_page = GetTargetPage(loader, i + j);
-				PageSetChecksumInplace(contained_page, LS_TOTAL_CNT(ls) + j);
+				PageHeader	page = (PageHeader) (buffer + (size_t) BLCKSZ * j);
+
+				page->pd_checksum = pg_checksum_page((char *) page, w->blkno + j);
 			}
-		}	
+		}
 #endif
 
-		/* Write the last block number to the load status file. */
-		UpdateLSF(loader, flush_num);
-
-		/*
-		 * Write flush_num blocks to the current file starting at block
-		 * offset i.  The current file might get full, ie, RELSEG_SIZE blocks
-		 * full, after writing that much (see how flush_num is calculated
-		 * above to understand why) .  We write the remaining content of the
-		 * block buffer (ie, loader->blocks) in the new file during the next
-		 * iteration.
-		 */
-		buffer = loader->blocks + BLCKSZ * i;
-		total = BLCKSZ * flush_num;
-		written = 0;
-		while (total > 0)
+		while (!abort && arena->error == 0 && total > 0)
 		{
-			int	len = write(loader->datafd, buffer + written, total);
-			if (len == -1)
+			ssize_t	len;
+
+#ifndef WIN32
+			len = pwrite(w->fd, buffer, total, offset);
+#else
+			if (lseek(w->fd, offset, SEEK_SET) < 0)
+				len = -1;
+			else
+				len = write(w->fd, buffer, total);
+#endif
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len <= 0)
 			{
-				/* fatal error, do not want to write blocks anymore */
-				ereport(ERROR, (errcode_for_file_access(),
-								errmsg("could not write to data file: %m")));
+				/* assume out of disk space if no bytes are written */
+				arena->error = (len < 0 ? errno : ENOSPC);
+				break;
 			}
-			written += len;
+
+			buffer += len;
+			offset += len;
 			total -= len;
 		}
 
-		i += flush_num;
+#ifdef HAVE_SYNC_FILE_RANGE
+		/*
+		 * Start writeback of the blocks now, so that dirty pages do not pile
+		 * up until the fsync at the end of the segment.  Errors are reported
+		 * by the fsync.
+		 */
+		if (!abort && arena->error == 0 && w->nblocks > 0)
+			(void) sync_file_range(w->fd, (off_t) BLCKSZ * w->segblk,
+								   (off_t) BLCKSZ * w->nblocks,
+								   SYNC_FILE_RANGE_WRITE);
+#endif
+
+		if (w->close)
+		{
+			if (!abort && arena->error == 0 && pg_fsync(w->fd) != 0)
+				arena->error = errno;
+			close(w->fd);
+		}
 	}
+}
 
-	/*
-	 * NOTICE: Be sure reset curblk to 0 and reinitialize recycled page
-	 * if you will continue to use blocks.
-	 */
+/**
+ * @brief Wait for the flush thread to write all submitted arenas, or to
+ * discard them if abort is true, and stop it.
+ */
+static void
+stop_flush_thread(DirectWriter *loader, bool abort)
+{
+	if (!loader->flush_started)
+		return;
+
+	pthread_mutex_lock(&loader->flush_lock);
+	loader->flush_stop = true;
+	loader->flush_abort = abort;
+	pthread_cond_broadcast(&loader->flush_cond);
+	pthread_mutex_unlock(&loader->flush_lock);
+
+	pthread_join(loader->flush_th, NULL);
+	pthread_cond_destroy(&loader->flush_cond);
+	pthread_mutex_destroy(&loader->flush_lock);
+	loader->flush_started = false;
+}
+
+/**
+ * @brief Main of the flush thread.  Writes arenas in the order they are
+ * filled until flush_stop is set and no arenas are left.
+ */
+static void *
+FlushThreadMain(void *arg)
+{
+	DirectWriter   *loader = (DirectWriter *) arg;
+	int				next = 0;
+
+	pthread_mutex_lock(&loader->flush_lock);
+	for (;;)
+	{
+		BlockArena *arena = &loader->arenas[next];
+		bool		abort;
+
+		while (!arena->submitted && !loader->flush_stop)
+			pthread_cond_wait(&loader->flush_cond, &loader->flush_lock);
+		if (!arena->submitted)
+			break;
+		abort = loader->flush_abort;
+		pthread_mutex_unlock(&loader->flush_lock);
+
+		write_arena(arena, abort);
+
+		pthread_mutex_lock(&loader->flush_lock);
+		arena->submitted = false;
+		pthread_cond_broadcast(&loader->flush_cond);
+		next = (next + 1) % loader->narenas;
+	}
+	pthread_mutex_unlock(&loader->flush_lock);
+
+	return NULL;
 }
 
 /**
  * @brief Open the next data file and returns its descriptor.
  * @param rnode  [in] RelFileNode of target relation.
+ * @param forknum [in] Fork of the data file.
  * @param blknum [in] Block number to seek.
  * @return File descriptor of the last data file.
  */
 static int
-open_data_file(RelFileNode rnode, bool istemp, BlockNumber blknum)
+open_data_file(RelFileNode rnode, bool istemp, ForkNumber forknum, BlockNumber blknum)
 {
 	int			fd = -1;
 	int			ret;
@@ -612,9 +2343,9 @@ open_data_file(RelFileNode rnode, bool istemp, BlockNumber blknum)
 	RelFileNodeBackend	bknode;
 	bknode.node = rnode;
 	bknode.backend = istemp ? MyBackendId : InvalidBackendId;
-	fname = relpath(bknode, MAIN_FORKNUM);
+	fname = relpath(bknode, forknum);
 #else
-	fname = relpath(rnode, MAIN_FORKNUM);
+	fname = relpath(rnode, forknum);
 #endif
 	segno = blknum / RELSEG_SIZE;
 	if (segno > 0)
@@ -646,6 +2377,45 @@ open_data_file(RelFileNode rnode, bool istemp, BlockNumber blknum)
 	return fd;
 }
 
+/**
+ * @brief Preallocate disk space for the data file ahead of the writes.
+ *
+ * The file size is not changed, so the preallocated space is invisible to
+ * PostgreSQL and recovery.  Segments are filled up except for the last one,
+ * whose unused space is released by close_data_file().
+ *
+ * @param loader [in/out] Direct Writer.
+ * @param blknum [in] First block number to be written to the current file.
+ * @param num [in] Number of blocks to be written to the current file.
+ */
+static void
+prealloc_data_file(DirectWriter *loader, BlockNumber blknum, int num)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+	uint64		segbeg = blknum - blknum % RELSEG_SIZE;
+	uint64		begin;
+	uint64		end;
+
+	if (loader->prealloc_failed ||
+		(uint64) blknum + num <= loader->prealloc_end)
+		return;
+
+	begin = Max(blknum, loader->prealloc_end);
+	end = Min((uint64) blknum + num + PREALLOC_BLOCKS, segbeg + RELSEG_SIZE);
+
+	/*
+	 * Give up preallocation if the filesystem does not support it. Running
+	 * out of space will be reported by the writes.
+	 */
+	if (fallocate(loader->datafd, FALLOC_FL_KEEP_SIZE,
+				  (off_t) BLCKSZ * (begin - segbeg),
+				  (off_t) BLCKSZ * (end - begin)) != 0)
+		loader->prealloc_failed = true;
+	else
+		loader->prealloc_end = (BlockNumber) end;
+#endif
+}
+
 /**
  * @brief Flush and close the data file.
  * @param loader [in] Direct Writer.
@@ -656,6 +2426,16 @@ close_data_file(DirectWriter *loader)
 {
 	if (loader->datafd != -1)
 	{
+#ifdef FALLOC_FL_KEEP_SIZE
+		struct stat	st;
+
+		/* Release the preallocated space beyond the last block. */
+		if (loader->prealloc_end > 0 &&
+			(fstat(loader->datafd, &st) != 0 ||
+			 ftruncate(loader->datafd, st.st_size) != 0))
+			ereport(WARNING, (errcode_for_file_access(),
+						errmsg("could not truncate data file: %m")));
+#endif
 		if (pg_fsync(loader->datafd) != 0)
 			ereport(WARNING, (errcode_for_file_access(),
 						errmsg("could not sync data file: %m")));
@@ -666,8 +2446,110 @@ close_data_file(DirectWriter *loader)
 	}
 }
 
+/**
+ * @brief Mark blocks all-visible in their page headers, the visibility map
+ * and the free space map.
+ *
+ * Must be called before the blocks are WAL-logged or checksummed.
+ *
+ * @param loader [in/out] Direct Writer.
+ * @param start [in] Block number of the first block in the arena.
+ * @param num [in] Number of blocks to be flushed.
+ */
+static void
+set_all_visible(DirectWriter *loader, BlockNumber start, int num)
+{
+	int		i;
+
+	for (i = 0; i < num; i++)
+	{
+		BlockNumber	blknum = start + i;
+		Page		page = GetTargetPage(loader, i);
+		uint8	   *map;
+
+		if (VM_HEAPBLK_TO_MAPBLOCK(blknum) != loader->vmblk)
+		{
+			write_vm_page(loader);
+			PageInit(loader->vmpage, BLCKSZ, 0);
+			loader->vmblk = VM_HEAPBLK_TO_MAPBLOCK(blknum);
+		}
+
+		PageSetAllVisible(page);
+		map = (uint8 *) PageGetContents(loader->vmpage);
+		map[VM_HEAPBLK_TO_MAPBYTE(blknum)] |=
+			(VM_ALL_BITS << VM_HEAPBLK_TO_OFFSET(blknum));
+
+		RecordPageWithFreeSpace(loader->base.rel, blknum,
+								PageGetHeapFreeSpace(page));
+	}
+}
+
+/**
+ * @brief Write the current visibility map page.
+ */
+static void
+write_vm_page(DirectWriter *loader)
+{
+	if (loader->vmfd == -1)
+		loader->vmfd = open_data_file(loader->ls.ls.rnode,
+									  RELATION_IS_LOCAL(loader->base.rel),
+									  VISIBILITYMAP_FORKNUM, 0);
+
+#if PG_VERSION_NUM >= 90300
+	if (DataChecksumsEnabled())
+		PageSetChecksumInplace(loader->vmpage, loader->vmblk);
+#endif
+
+	if (lseek(loader->vmfd, (off_t) BLCKSZ * loader->vmblk, SEEK_SET) < 0 ||
+		write(loader->vmfd, loader->vmpage, BLCKSZ) != BLCKSZ)
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not write visibility map: %m")));
+}
+
+/**
+ * @brief Write the last visibility map page, and update the upper levels
+ * of the free space map.
+ */
+static void
+close_vm_file(DirectWriter *loader, bool onError)
+{
+	if (!loader->freeze)
+		return;
+
+	if (!onError && LS_TOTAL_CNT(&loader->ls) > 0)
+	{
+		write_vm_page(loader);
+		if (pg_fsync(loader->vmfd) != 0)
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not sync visibility map: %m")));
+
+		FreeSpaceMapVacuum(loader->base.rel);
+
+		/* the visibility map fork was created behind smgr */
+#if PG_VERSION_NUM >= 90000
+		if (loader->base.rel->rd_smgr != NULL)
+			loader->base.rel->rd_smgr->smgr_vm_nblocks = InvalidBlockNumber;
+#else
+		loader->base.rel->rd_vm_nblocks = InvalidBlockNumber;
+#endif
+	}
+
+	if (loader->vmfd != -1)
+	{
+		close(loader->vmfd);
+		loader->vmfd = -1;
+	}
+}
+
 /**
  * @brief Update load status file.
+ *
+ * The LSF must count blocks before they are written to the data files.  If
+ * LSF_RESERVE is set, the LSF records lsf_reserve blocks more than created,
+ * and is rewritten and synced only when the created blocks run out of the
+ * reservation.  Recovery clears pages in the reserved range only until the
+ * end of the data files.
+ *
  * @param loader [in/out] Load status information
  * @param num [in] the number of blocks already written
  * @return void
@@ -677,11 +2559,25 @@ UpdateLSF(DirectWriter *loader, BlockNumber num)
 {
 	int			ret;
 	LoadStatus *ls = &loader->ls;
+	LoadStatus	lsf;
 
 	ls->ls.create_cnt += num;
 
+	/* no load status file for a fresh relfilenode */
+	if (loader->fresh)
+		return;
+
+	/* no need to write if the blocks are in the reservation */
+	if (ls->ls.create_cnt <= loader->lsf_cnt)
+		return;
+
+	lsf = *ls;
+	if (loader->lsf_reserve > 0)
+		lsf.ls.create_cnt = Min((uint64) ls->ls.create_cnt + loader->lsf_reserve,
+								MaxBlockNumber - ls->ls.exist_cnt);
+
 	lseek(loader->lsf_fd, 0, SEEK_SET);
-	ret = write(loader->lsf_fd, ls, sizeof(LoadStatus));
+	ret = write(loader->lsf_fd, &lsf, sizeof(LoadStatus));
 	if (ret != sizeof(LoadStatus))
 		ereport(ERROR, (errcode_for_file_access(),
 						errmsg("could not write to \"%s\": %m",
@@ -690,6 +2586,8 @@ UpdateLSF(DirectWriter *loader, BlockNumber num)
 		ereport(ERROR,
 				(errcode_for_file_access(),
 				 errmsg("could not fsync file \"%s\": %m", loader->lsf_path)));
+
+	loader->lsf_cnt = lsf.ls.create_cnt;
 }
 
 static void
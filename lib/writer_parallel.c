@@ -30,6 +30,10 @@
 #define DEFAULT_BUFFER_SIZE		(16 * 1024 * 1024)	/* 16MB */
 #define DEFAULT_TIMEOUT_MSEC	100	/* 100ms */
 
+/* limits of tuples sent to the queue at once */
+#define QUEUE_WRITE_TUPLES		64
+#define QUEUE_WRITE_BYTES		(DEFAULT_BUFFER_SIZE / 4)
+
 typedef struct ParallelWriter
 {
 	Writer	base;
@@ -41,12 +45,14 @@ typedef struct ParallelWriter
 
 static void	ParallelWriterInit(ParallelWriter *self);
 static void	ParallelWriterInsert(ParallelWriter *self, HeapTuple tuple);
+static void	ParallelWriterInsertBatch(ParallelWriter *self, HeapTuple *tuples, int ntuples);
 static WriterResult	ParallelWriterClose(ParallelWriter *self, bool onError);
 static bool	ParallelWriterParam(ParallelWriter *self, const char *keyword, char *value);
 static void	ParallelWriterDumpParams(ParallelWriter *self);
 static int	ParallelWriterSendQuery(ParallelWriter *self, PGconn *conn, char *queueName, char *logfile, bool verbose);
 static const char *finish_and_get_message(ParallelWriter *self);
 static void write_queue(ParallelWriter *self, const void *buffer, uint32 len);
+static void write_queue_iov(ParallelWriter *self, const struct iovec iov[], int count);
 static void transfer_message(void *arg, const PGresult *res);
 static char *escape_param_str(const char *str);
 static PGconn *connect_to_localhost(void);
@@ -63,6 +69,7 @@ CreateParallelWriter(void *opt)
 	self = palloc0(sizeof(ParallelWriter));
 	self->base.init = (WriterInitProc) ParallelWriterInit;
 	self->base.insert = (WriterInsertProc) ParallelWriterInsert,
+	self->base.insertBatch = (WriterInsertBatchProc) ParallelWriterInsertBatch,
 	self->base.close = (WriterCloseProc) ParallelWriterClose,
 	self->base.param = (WriterParamProc) ParallelWriterParam;
 	self->base.dumpParams = (WriterDumpParamsProc) ParallelWriterDumpParams,
@@ -158,6 +165,43 @@ ParallelWriterInsert(ParallelWriter *self, HeapTuple tuple)
 	write_queue(self, tuple->t_data, tuple->t_len);
 }
 
+/*
+ * Send tuples to the queue in groups, so that the reader process sees the
+ * end of the queue moved once for each group rather than for each tuple.
+ */
+static void
+ParallelWriterInsertBatch(ParallelWriter *self, HeapTuple *tuples, int ntuples)
+{
+	struct iovec	iov[QUEUE_WRITE_TUPLES * 2];
+	int				count = 0;
+	uint32			total = 0;
+	int				i;
+
+	for (i = 0; i < ntuples; i++)
+	{
+		uint32	len = sizeof(uint32) + tuples[i]->t_len;
+
+		if (count > 0 &&
+			(count >= lengthof(iov) || total + len >= QUEUE_WRITE_BYTES))
+		{
+			write_queue_iov(self, iov, count);
+			count = 0;
+			total = 0;
+		}
+
+		/* same format as write_queue */
+		iov[count].iov_base = &tuples[i]->t_len;
+		iov[count].iov_len = sizeof(uint32);
+		iov[count + 1].iov_base = tuples[i]->t_data;
+		iov[count + 1].iov_len = tuples[i]->t_len;
+		count += 2;
+		total += len;
+	}
+
+	if (count > 0)
+		write_queue_iov(self, iov, count);
+}
+
 static WriterResult
 ParallelWriterClose(ParallelWriter *self, bool onError)
 {
@@ -307,8 +351,6 @@ write_queue(ParallelWriter *self, const void *buffer, uint32 len)
 {
 	struct iovec	iov[2];
 
-	AssertArg(self->conn != NULL);
-	AssertArg(self->queue != NULL);
 	AssertArg(len == 0 || buffer != NULL);
 
 	iov[0].iov_base = &len;
@@ -316,9 +358,18 @@ write_queue(ParallelWriter *self, const void *buffer, uint32 len)
 	iov[1].iov_base = (void *) buffer;
 	iov[1].iov_len = len;
 
+	write_queue_iov(self, iov, 2);
+}
+
+static void
+write_queue_iov(ParallelWriter *self, const struct iovec iov[], int count)
+{
+	AssertArg(self->conn != NULL);
+	AssertArg(self->queue != NULL);
+
 	for (;;)
 	{
-		if (QueueWrite(self->queue, iov, 2, DEFAULT_TIMEOUT_MSEC, false))
+		if (QueueWrite(self->queue, iov, count, DEFAULT_TIMEOUT_MSEC, false))
 			return;
 
 		PQconsumeInput(self->conn);